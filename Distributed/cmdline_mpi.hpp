@@ -14,33 +14,39 @@ static inline void usage(const char *argv0) {
     std::printf("--------------------\n");
     std::printf("Usage: %s [options] file-or-directory [file-or-directory]\n", argv0);
     std::printf("\nOptions:\n");
-    std::printf(" -t set the \"BIG file\" low threshold (in Mbyte -- min. and default %ld Mbyte)\n", BIGFILE_LOW_THRESHOLD /(1024 * 1024));
+    std::printf(" -t set the \"BIG file\" low threshold, i.e. the block size (in Mbyte -- min. and default %ld Mbyte, or in Kbyte with a K suffix -- min. %dK)\n", BIGFILE_LOW_THRESHOLD /(1024 * 1024), MIN_BLOCK_SIZE / 1024);
+    std::printf("    -t auto chooses it from the input size, the n. of workers and the memory, -t file also adapts it to each file\n");
     std::printf(" -R 0 does not recur, 1 will process the content of all subdirectories (default R=%d)\n", RECUR ? 1 : 0);
     std::printf(" -C compress: 0 preserves, 1 removes the original file (default C=%d)\n", REMOVE_ORIGIN ? 1 : 0);
     std::printf(" -D decompress: 0 preserves, 1 removes the original file (default D=%d)\n", REMOVE_ORIGIN ? 1 : 0);
+    std::printf(" -V 1 test mode: decompresses and checks the compressed files without writing anything (default V=%d)\n", VERIFY ? 1 : 0);
     std::printf(" -q 0 silent mode, 1 prints only error messages to stderr, 2 verbose (default q=%d)\n", QUITE_MODE ? 1 : 0);
+    std::printf(" -L compression level, from 0 (no compression) to 10 (best) (default L=%d)\n", LEVEL);
+    std::printf(" -S deflate strategy: 0 default, 1 filtered, 2 huffman only, 3 rle, 4 fixed (default S=%d)\n", STRATEGY);
+    std::printf(" -P 1 stores the incompressible blocks as they are, 0 compresses all the blocks (default P=%d)\n", PROBE ? 1 : 0);
+    std::printf(" -d 1 chains the blocks of a \"BIG file\": each one uses the end of the previous one as dictionary (format 2 or 3, default d=%d)\n", CHAIN ? 1 : 0);
+    std::printf(" -f format of the compressed files: 1 header first, 2 trailer index, 3 gzip (.gz, for gzip -d) (default f=%d)\n", FORMAT);
+    std::printf(" -p n. of blocks outstanding per worker thread, the worker asks for a new one for each result it sends back (default p=%ld)\n", DEPTH);
+    std::printf(" -T n. of threads of each worker that process its blocks, 0 uses all the cores of its node (default T=%ld)\n", THREADS);
     std::printf("--------------------\n");
 }
 
 int parseCommandLine(int argc, char *argv[]) {
     extern char *optarg;
-    const std::string optstr="t:R:C:D:q:";
+    const std::string optstr="t:R:C:D:V:q:f:L:S:P:d:p:T:";
     
     long opt, start = 1;
-    bool cpresent = false, dpresent = false; // flags for the presence of -C and -D
+    bool cpresent = false, dpresent = false, vpresent = false; // flags for the presence of -C, -D and -V
 
     while((opt = getopt(argc, argv, optstr.c_str())) != -1) {
         switch(opt) {
             case 't': {
-                long t = 0;
-                if (!isNumber(optarg, t)) {
+                if (!parseBlockSize(optarg)) {
                     std::fprintf(stderr, "Error: wrong '-t' option\n");
                     usage(argv[0]);
                     return -1;
                 }
-                t = std::max(2l, t); // min threshold accepted is 2MB (2l = 2 long)
-                BIGFILE_LOW_THRESHOLD = t * (1024 * 1024); // convert to bytes
-                if (t > 100) { // just to set a limit
+                if (BIGFILE_LOW_THRESHOLD > MAX_BLOCK_SIZE) { // just to set a limit
                     std::fprintf(stderr, "Error: \"BIG file\" low threshold too high, set it lower than 100 MB\n"); 
                     return -1;
                 } 
@@ -79,6 +85,20 @@ int parseCommandLine(int argc, char *argv[]) {
                 comp = false; // comp = true in utility_mpi.hpp, so by default it compresses 
                 start += 2;
             } break;
+            case 'V': {
+                long v = 0;
+                if (!isNumber(optarg, v)) {
+                    std::fprintf(stderr, "Error: wrong '-V' option\n");
+                    usage(argv[0]);
+                    return -1;
+                }
+                if (v == 1) {
+                    vpresent = true;
+                    VERIFY = true;
+                    comp = false; // the compressed files are decompressed, but nothing is written
+                }
+                start += 2;
+            } break;
             case 'q': {
                 long q = 0;
                 if (!isNumber(optarg, q)) {
@@ -89,6 +109,76 @@ int parseCommandLine(int argc, char *argv[]) {
                 QUITE_MODE = q;
                 start += 2; 
             } break;
+            case 'L': {
+                long l = 0;
+                if (!isNumber(optarg, l) || l < 0 || l > 10) {
+                    std::fprintf(stderr, "Error: wrong '-L' option, the level goes from 0 to 10\n");
+                    usage(argv[0]);
+                    return -1;
+                }
+                LEVEL = l;
+                start += 2;
+            } break;
+            case 'S': {
+                long st = 0;
+                if (!isNumber(optarg, st) || st < MZ_DEFAULT_STRATEGY || st > MZ_FIXED) {
+                    std::fprintf(stderr, "Error: wrong '-S' option, the strategy goes from 0 to 4\n");
+                    usage(argv[0]);
+                    return -1;
+                }
+                STRATEGY = st;
+                start += 2;
+            } break;
+            case 'P': {
+                long pr = 0;
+                if (!isNumber(optarg, pr)) {
+                    std::fprintf(stderr, "Error: wrong '-P' option\n");
+                    usage(argv[0]);
+                    return -1;
+                }
+                if (pr == 0) PROBE = false;
+                start += 2;
+            } break;
+            case 'd': {
+                long d = 0;
+                if (!isNumber(optarg, d)) {
+                    std::fprintf(stderr, "Error: wrong '-d' option\n");
+                    usage(argv[0]);
+                    return -1;
+                }
+                if (d == 1) CHAIN = true;
+                start += 2;
+            } break;
+            case 'f': {
+                long f = 0;
+                if (!isNumber(optarg, f) || f < 1 || f > 3) {
+                    std::fprintf(stderr, "Error: wrong '-f' option, the format can be 1, 2 or 3\n");
+                    usage(argv[0]);
+                    return -1;
+                }
+                FORMAT = f;
+                start += 2;
+            } break;
+            case 'p': {
+                long p = 0;
+                if (!isNumber(optarg, p) || p <= 0) {
+                    std::fprintf(stderr, "Error: wrong '-p' option, at least one block per worker\n");
+                    usage(argv[0]);
+                    return -1;
+                }
+                DEPTH = p;
+                start += 2;
+            } break;
+            case 'T': {
+                long t = 0;
+                if (!isNumber(optarg, t) || t < 0) {
+                    std::fprintf(stderr, "Error: wrong '-T' option, the n. of threads of each worker (0: all its cores)\n");
+                    usage(argv[0]);
+                    return -1;
+                }
+                THREADS = t;
+                start += 2;
+            } break;
             default:
                 usage(argv[0]);
                 return -1;
@@ -99,6 +189,16 @@ int parseCommandLine(int argc, char *argv[]) {
 		usage(argv[0]);
 		return -1;
     }
+    if (vpresent && (cpresent || dpresent)) {
+		std::fprintf(stderr, "Error: -V cannot be used with -C or -D!\n");
+		usage(argv[0]);
+		return -1;
+    }
+    if (CHAIN && FORMAT == 1) {
+		std::fprintf(stderr, "Error: -d 1 needs the format 2 or 3 (the blocks are flagged in the index or form a single stream)!\n");
+		usage(argv[0]);
+		return -1;
+    }
     if ((argc - start) <= 0) {
 		std::fprintf(stderr, "Error: at least one file or directory should be provided!\n");
 		usage(argv[0]);
@@ -4,6 +4,10 @@
 #include <vector>
 #include <fstream>
 #include <map>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
 
 #include <mpi.h>
 
@@ -18,17 +22,22 @@ struct MetaBlock {
     size_t cmp_size;        // output size
     size_t blockid;         // block identifier (for "BIG files")
     size_t nblocks;         // #blocks in which a "BIG file" is split
+    size_t flags;           // BLOCK_STORED: the block is stored as it is (not compressed), BLOCK_CRC, BLOCK_CORRUPTED
+    size_t crc;             // CRC32 of the original block (if BLOCK_CRC)
+    size_t dict;            // chained block: #bytes of dictionary (compression: sent in front of the data)
 };
 
+#define BLOCK_CORRUPTED 8   // test mode: the worker has found the block corrupted (only sent back to the master)
+
 // --------------------------------------------------------------------------------------------------- datatype ----------------
 // MPI datatype for MetaBlock
 MPI_Datatype MPI_MetaBlock;
 void createMetaBlockType() {
     MetaBlock block;
 
-    int blocklengths[5] = {1, 256, 1, 1, 1};
-    MPI_Datatype types[5] = {MPI_UNSIGNED_LONG, MPI_CHAR, MPI_UNSIGNED_LONG, MPI_UNSIGNED_LONG, MPI_UNSIGNED_LONG};
-    MPI_Aint base, displacements[5];
+    int blocklengths[8] = {1, 256, 1, 1, 1, 1, 1, 1};
+    MPI_Datatype types[8] = {MPI_UNSIGNED_LONG, MPI_CHAR, MPI_UNSIGNED_LONG, MPI_UNSIGNED_LONG, MPI_UNSIGNED_LONG, MPI_UNSIGNED_LONG, MPI_UNSIGNED_LONG, MPI_UNSIGNED_LONG};
+    MPI_Aint base, displacements[8];
 
     MPI_Get_address(&block, &base);
     MPI_Get_address(&block.size, &displacements[0]);
@@ -36,22 +45,422 @@ void createMetaBlockType() {
     MPI_Get_address(&block.cmp_size, &displacements[2]);
     MPI_Get_address(&block.blockid, &displacements[3]);
     MPI_Get_address(&block.nblocks, &displacements[4]);
+    MPI_Get_address(&block.flags, &displacements[5]);
+    MPI_Get_address(&block.crc, &displacements[6]);
+    MPI_Get_address(&block.dict, &displacements[7]);
 
-    for (int i = 0; i < 5; i++) {
+    for (int i = 0; i < 8; i++) {
         displacements[i] -= base;
     }
 
-    MPI_Type_create_struct(5, blocklengths, displacements, types, &MPI_MetaBlock);
+    MPI_Type_create_struct(8, blocklengths, displacements, types, &MPI_MetaBlock);
     MPI_Type_commit(&MPI_MetaBlock);
 }
 
+// --------------------------------------------------------------------------------------------------- writer ------------------
+// Output of the master: a thread that writes the files while the master keeps receiving the results of the workers.
+// The blocks are queued by the master (at most `limit`, then it waits) and each file is written as soon as its last
+// block is in, so that only the files still incomplete are kept in memory
+struct Writer {
+    Writer(size_t limit) : limit(limit), thread([this] { run(); }) {}
+
+    // queue a block for its file
+    void push(const MetaBlock &meta, std::vector<char> &&data) {
+        std::unique_lock<std::mutex> lock(mtx);
+        room.wait(lock, [&] { return queue.size() < limit; });
+        queue.emplace_back(meta, std::move(data));
+        ready.notify_one();
+    }
+
+    // no more blocks: write the ones still queued and stop the thread
+    void close() {
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            done = true;
+        }
+        ready.notify_one();
+        thread.join();
+    }
+
+    // files that could not be written (after close)
+    size_t failures() const { return failedFiles; }
+
+  private:
+    void run() {
+        while (true) {
+            std::unique_lock<std::mutex> lock(mtx);
+            ready.wait(lock, [&] { return done || !queue.empty(); });
+            if (queue.empty()) return;
+            auto [meta, data] = std::move(queue.front());
+            queue.pop_front();
+            room.notify_one();
+            lock.unlock();
+
+            if (comp && FORMAT == 2) {
+                appendBlock(meta, data);
+                continue;
+            }
+            auto &blocks = filesMap[meta.filename];
+            blocks.emplace_back(meta, std::move(data));
+            if (blocks.size() == meta.nblocks) {
+                writeFile(meta.filename, blocks);
+                filesMap.erase(meta.filename);
+            }
+        }
+    }
+
+    // Format 2: the compressed blocks are appended to their file as soon as they arrive, only the index is kept
+    void appendBlock(const MetaBlock &meta, const std::vector<char> &data) {
+        OutFile &f = outFiles[meta.filename];
+        if (f.received == 0) {
+            f.out.open(std::string(meta.filename) + SUFFIX, std::ios::binary);
+            if (!f.out) {
+                std::cerr << "Error opening file for writing: " << meta.filename << SUFFIX << std::endl;
+                f.ok = false;
+                ++failedFiles;
+            }
+            f.index.resize(meta.nblocks);
+        }
+        // the file could not be opened: its blocks are dropped
+        if (!f.ok) {
+            if (++f.received == meta.nblocks) outFiles.erase(meta.filename);
+            return;
+        }
+        // Append the block and record where it is
+        f.index[meta.blockid - 1] = {meta.size, meta.cmp_size, (size_t)f.out.tellp(), meta.flags, meta.crc};
+        f.out.write(data.data(), data.size());
+
+        // Last block of the file: write the index and the trailer
+        if (++f.received == meta.nblocks) {
+            Trailer trailer = makeTrailer(f.index.size());
+            f.out.write(reinterpret_cast<const char*>(f.index.data()), f.index.size() * sizeof(BlockIndex));
+            f.out.write(reinterpret_cast<const char*>(&trailer), sizeof(Trailer));
+            f.out.close();
+            if (!f.out) {
+                std::cerr << "Error writing file: " << meta.filename << SUFFIX << std::endl;
+                ++failedFiles;
+            } else if (REMOVE_ORIGIN) {
+                unlink(meta.filename);
+            }
+            outFiles.erase(meta.filename);
+        }
+    }
+
+    // All the blocks of a file are in: sort them and write the file
+    void writeFile(const std::string &filename, std::vector<std::pair<MetaBlock, std::vector<char>>> &blocks) {
+        if (QUITE_MODE >= 2) {
+            std::fprintf(stderr, "Master has %lu pairs of (MetaBlock, data) for file %s\n", blocks.size(), filename.c_str());
+        }
+
+        // Sort the blocks by blockid
+        std::sort(blocks.begin(), blocks.end(), [](const std::pair<MetaBlock, std::vector<char>>& a, const std::pair<MetaBlock, std::vector<char>>& b) {
+            return a.first.blockid < b.first.blockid;
+        });
+
+        // Determine the output filename
+        std::string outputFilename;
+        if (comp) {
+            outputFilename = filename + outSuffix();
+        } else {
+            outputFilename = filename.substr(0, filename.size() - strlen(SUFFIX));
+        }
+
+        // Create the output file
+        std::ofstream outFile(outputFilename, std::ios::binary);
+
+        if (!outFile) {
+            std::cerr << "Error opening file for writing: " << filename << std::endl;
+            ++failedFiles;
+            return;
+        }
+
+        if (comp && FORMAT == 3) { // gzip: the header does not depend on the blocks
+            outFile.write(reinterpret_cast<const char*>(GZ_HEADER), GZ_HEADER_SIZE);
+        } else if (comp) { // Write the header in the compressed file
+            size_t nblocks = blocks[0].first.nblocks;
+            outFile.write(reinterpret_cast<char*>(&nblocks), sizeof(size_t));
+
+            for (const auto& [metaBlock, _] : blocks) {
+                outFile.write(reinterpret_cast<const char*>(&metaBlock.size), sizeof(size_t));
+                outFile.write(reinterpret_cast<const char*>(&metaBlock.cmp_size), sizeof(size_t));
+            }
+        }
+
+        // Write the data
+        for (const auto& [_, data] : blocks) {
+            outFile.write(data.data(), data.size());
+        }
+
+        if (comp && FORMAT == 3) { // gzip trailer: CRC32 of the whole file, combined from the ones of the blocks, and its size
+            size_t crc = MZ_CRC32_INIT, size = 0;
+            for (const auto& [metaBlock, _] : blocks) {
+                crc = crc32Combine(crc, metaBlock.crc, metaBlock.size);
+                size += metaBlock.size;
+            }
+            unsigned char trailer[GZ_TRAILER_SIZE];
+            gzTrailer(trailer, crc, size);
+            outFile.write(reinterpret_cast<const char*>(trailer), GZ_TRAILER_SIZE);
+        }
+
+        outFile.close(); 
+        if (!outFile) {
+            std::cerr << "Error writing file: " << outputFilename << std::endl;
+            ++failedFiles;
+            return;
+        }
+
+        // Remove original file if flag is set
+        if (REMOVE_ORIGIN) {
+            unlink(filename.c_str());
+        }
+    }
+
+    struct OutFile {
+        std::ofstream out;
+        size_t received = 0;
+        bool ok = true;                         // false if the file could not be opened
+        std::vector<BlockIndex> index;
+    };
+    std::map<std::string, OutFile> outFiles;    // format 2: files being appended
+    std::map<std::string, std::vector<std::pair<MetaBlock, std::vector<char>>>> filesMap; // blocks of the files not complete yet
+
+    const size_t limit;
+    std::deque<std::pair<MetaBlock, std::vector<char>>> queue;
+    bool done = false;
+    std::mutex mtx;
+    std::condition_variable ready, room;
+    size_t failedFiles = 0;                     // written by the thread only, read after close
+    std::thread thread;                         // last: it starts when everything else is ready
+};
+
+// --------------------------------------------------------------------------------------------------- worker ------------------
+// Compress or decompress a block received by a worker: sendData gets the result, the metadata is updated for the master.
+// codec is the deflate/inflate state of the thread, reused for all its blocks, and tails has the end of the last block
+// decompressed of each chained file. It returns false if the block cannot be processed
+static bool processBlock(MetaBlock &receivedMetaBlock, std::vector<char> &receivedData, std::vector<char> &sendData,
+                         Codec &codec, std::map<std::string, std::vector<char>> &tails, int myId) {
+    if (QUITE_MODE >= 2) {
+        std::fprintf(stderr, "Worker %d received metadata block: size %zu, filename %s, cmp_size %zu, blockid %zu, nblocks %zu\n", myId, receivedMetaBlock.size, receivedMetaBlock.filename, receivedMetaBlock.cmp_size, receivedMetaBlock.blockid, receivedMetaBlock.nblocks);
+        std::fprintf(stderr, "Worker %d received data block: size %zu\n", myId, receivedData.size());
+    }
+
+    // Process the data block (compress or decompress) -----------------------------------------------------------------------------
+    size_t size = receivedMetaBlock.size;
+    size_t cmp_size = receivedMetaBlock.cmp_size;
+
+    if (comp) { 
+        unsigned char *inPtr = reinterpret_cast<unsigned char*>(receivedData.data()) + receivedMetaBlock.dict;
+
+        // CRC32 of the original block, to be checked when it is decompressed (format 1 has no room for it)
+        // or combined in the gzip trailer
+        if (FORMAT != 1) {
+            receivedMetaBlock.crc = blockCrc(inPtr, size);
+            receivedMetaBlock.flags |= BLOCK_CRC;
+        }
+
+        // incompressible blocks are stored as they are, compressing them would only waste CPU time
+        bool stored = incompressible(inPtr, size);
+
+        if (!stored) {
+            // get an estimation of the maximum compression size
+            unsigned long cmp_len = compressBound(size);
+
+            // allocate memory to store compressed data in memory
+            unsigned char *ptrOut = new unsigned char[cmp_len];
+
+            // compress the data (gzip: raw deflate, only the last block of the file ends the stream)
+            const bool ok = (FORMAT == 3) ? codec.compressRaw(ptrOut, &cmp_len, inPtr, size, receivedMetaBlock.blockid == receivedMetaBlock.nblocks, receivedMetaBlock.dict)
+                                          : codec.compress(ptrOut, &cmp_len, inPtr, size, receivedMetaBlock.dict);
+            if (!ok) {
+                std::cerr << "Process " << myId << " failed to compress the data" << std::endl;
+                delete [] ptrOut;
+                return false;
+            }
+
+            if (QUITE_MODE >= 2) {
+                std::fprintf(stderr, "Worker %d has compressed the block %zu of file %s.\n", myId, receivedMetaBlock.blockid, receivedMetaBlock.filename);
+            }
+
+            // no gain: store the block as it is (format 2 only, format 1 has no flags)
+            stored = (FORMAT == 2 && cmp_len >= size);
+            if (!stored) {
+                // update cmp_size to cmp_len in receivedMetaBlock and save compressed data in the sendData vector
+                receivedMetaBlock.cmp_size = cmp_len;
+                sendData.resize(cmp_len);
+                std::memcpy(sendData.data(), ptrOut, cmp_len);
+            }
+            delete [] ptrOut;
+        }
+
+        if (stored) {
+            if (QUITE_MODE >= 2) {
+                std::fprintf(stderr, "Worker %d stores the block %zu of file %s.\n", myId, receivedMetaBlock.blockid, receivedMetaBlock.filename);
+            }
+            receivedMetaBlock.flags |= BLOCK_STORED;
+            receivedMetaBlock.cmp_size = size;
+            sendData.assign(receivedData.begin() + receivedMetaBlock.dict, receivedData.end());
+        }
+
+    } else {
+        // decompress the data in the sendData vector (cmp_size is the size of the original block),
+        // stored blocks are already the original data
+        // a chained block is decompressed after the end of the previous one, that is its dictionary
+        const size_t dict = receivedMetaBlock.dict;
+        sendData.resize(dict + cmp_size);
+        unsigned char *ptrOut = reinterpret_cast<unsigned char*>(sendData.data()) + dict;
+        bool ok = true;
+        if (dict) {
+            auto it = tails.find(receivedMetaBlock.filename);
+            ok = (it != tails.end() && it->second.size() >= dict);
+            if (ok) std::memcpy(sendData.data(), it->second.data() + it->second.size() - dict, dict);
+        }
+        if (ok && (receivedMetaBlock.flags & BLOCK_STORED)) {
+            ok = (size == cmp_size);
+            if (ok) std::memcpy(ptrOut, receivedData.data(), size);
+        } else if (ok) {
+            size_t out_size = cmp_size;
+            ok = codec.uncompress(ptrOut, &out_size, reinterpret_cast<unsigned char*>(receivedData.data()), size, dict) && (out_size == cmp_size);
+        }
+        // check the CRC32 of the original block, if the index has it
+        if (ok && (receivedMetaBlock.flags & BLOCK_CRC)) {
+            ok = (blockCrc(ptrOut, cmp_size) == receivedMetaBlock.crc);
+        }
+
+        // keep the end of the block for the next one of a chained file
+        if (receivedMetaBlock.flags & BLOCK_DICT) {
+            if (ok && receivedMetaBlock.blockid < receivedMetaBlock.nblocks) {
+                const size_t len = std::min(cmp_size, (size_t)DICT_SIZE);
+                tails[receivedMetaBlock.filename].assign(ptrOut + cmp_size - len, ptrOut + cmp_size);
+            } else {
+                tails.erase(receivedMetaBlock.filename);
+            }
+        }
+        if (dict) sendData.erase(sendData.begin(), sendData.begin() + dict);
+
+        if (VERIFY) {
+            // Test mode: only the result goes back to the master
+            if (!ok) {
+                receivedMetaBlock.flags |= BLOCK_CORRUPTED;
+                if (QUITE_MODE >= 1) {
+                    std::fprintf(stderr, "Worker %d: block %zu of file %s is corrupted\n", myId, receivedMetaBlock.blockid, receivedMetaBlock.filename);
+                }
+            }
+            receivedMetaBlock.cmp_size = 0;
+            sendData.clear();
+        } else if (!ok) {
+            std::cerr << "Process " << myId << " failed to decompress the data" << std::endl;
+            return false;
+        }
+
+        if (QUITE_MODE >= 2) {
+            std::fprintf(stderr, "Worker %d has decompressed the block %zu of file %s.\n", myId, receivedMetaBlock.blockid, receivedMetaBlock.filename);
+        }
+    }
+    return true;
+}
+
+// A block received by a worker, and then its result
+struct Block {
+    MetaBlock meta;
+    std::vector<char> data;
+    bool ok = true;
+};
+
+// Threads of a worker rank (-T): they process the blocks received by the main thread of the rank, that is the only
+// one that calls MPI (MPI_THREAD_FUNNELED), and give it back the results to send to the master.
+// The blocks of a chained file to decompress need the end of the previous one: all of them go to the same thread
+struct WorkerPool {
+    WorkerPool(size_t nthreads, int myId) : own(nthreads), myId(myId) {
+        for (size_t i = 0; i < nthreads; ++i) threads.emplace_back([this, i] { run(i); });
+    }
+
+    // a block to process
+    void push(Block &&block) {
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            if (!comp && (block.meta.flags & BLOCK_DICT)) {
+                own[std::hash<std::string>{}(block.meta.filename) % own.size()].push_back(std::move(block));
+            } else {
+                todo.push_back(std::move(block));
+            }
+        }
+        work.notify_all();
+    }
+
+    // a processed block, if there is one
+    bool pop(Block &block) {
+        std::lock_guard<std::mutex> lock(mtx);
+        if (results.empty()) return false;
+        block = std::move(results.front());
+        results.pop_front();
+        return true;
+    }
+
+    // wait until there is a processed block (some block has to be in the pool)
+    void wait() {
+        std::unique_lock<std::mutex> lock(mtx);
+        finished.wait(lock, [&] { return !results.empty(); });
+    }
+
+    // no more blocks: the threads end when they have processed the ones queued
+    void close() {
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            done = true;
+        }
+        work.notify_all();
+        for (auto &t : threads) t.join();
+    }
+
+  private:
+    void run(size_t id) {
+        Codec codec(LEVEL, STRATEGY);
+        std::map<std::string, std::vector<char>> tails;
+        while (true) {
+            Block block;
+            {
+                std::unique_lock<std::mutex> lock(mtx);
+                work.wait(lock, [&] { return done || !own[id].empty() || !todo.empty(); });
+                auto &queue = !own[id].empty() ? own[id] : todo;
+                if (queue.empty()) return;
+                block = std::move(queue.front());
+                queue.pop_front();
+            }
+            std::vector<char> result;
+            block.ok = processBlock(block.meta, block.data, result, codec, tails, myId);
+            block.data = std::move(result);
+            {
+                std::lock_guard<std::mutex> lock(mtx);
+                results.push_back(std::move(block));
+            }
+            finished.notify_one();
+        }
+    }
+
+    std::deque<Block> todo;                 // blocks for any thread
+    std::vector<std::deque<Block>> own;     // blocks of the chained files, per thread
+    std::deque<Block> results;
+    bool done = false;
+    std::mutex mtx;
+    std::condition_variable work, finished;
+    std::vector<std::thread> threads;
+    const int myId;
+};
+
 // --------------------------------------------------------------------------------------------------- main --------------------
 int main(int argc, char *argv[]) {
-    MPI_Init(&argc, &argv);
+    // the master walks the input and writes the files with some threads, the workers process their blocks with some
+    // threads (-T): only the main thread of each process calls MPI
+    int provided;
+    MPI_Init_thread(&argc, &argv, MPI_THREAD_FUNNELED, &provided);
     int myId;
     int numP;
     MPI_Comm_rank(MPI_COMM_WORLD, &myId);
     MPI_Comm_size(MPI_COMM_WORLD, &numP);
+    if (provided < MPI_THREAD_FUNNELED) {
+        if (!myId) std::fprintf(stderr, "Error: the MPI library does not support threads (MPI_THREAD_FUNNELED)\n");
+        MPI_Abort(MPI_COMM_WORLD, -1);
+    }
 
     // Create the MPI datatype for MetaBlock
     createMetaBlockType();
@@ -79,178 +488,383 @@ int main(int argc, char *argv[]) {
     MPI_Bcast(&comp, 1, MPI_C_BOOL, 0, MPI_COMM_WORLD);
     MPI_Bcast(&BIGFILE_LOW_THRESHOLD, 1, MPI_LONG, 0, MPI_COMM_WORLD);
     MPI_Bcast(&QUITE_MODE, 1, MPI_INT, 0, MPI_COMM_WORLD);
-
-    // Vector to store the pairs of (MetaBlock, data) to send back to the master
-    std::vector<std::pair<MetaBlock, std::vector<char>>> pairs;
+    MPI_Bcast(&FORMAT, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    MPI_Bcast(&LEVEL, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    MPI_Bcast(&STRATEGY, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    MPI_Bcast(&PROBE, 1, MPI_C_BOOL, 0, MPI_COMM_WORLD);
+    MPI_Bcast(&VERIFY, 1, MPI_C_BOOL, 0, MPI_COMM_WORLD);
+    MPI_Bcast(&THREADS, 1, MPI_LONG, 0, MPI_COMM_WORLD);
+    MPI_Bcast(&DEPTH, 1, MPI_LONG, 0, MPI_COMM_WORLD);
+
+    // Threads of each worker (-T 0: all the cores of its node), the master sends ahead DEPTH blocks per thread
+    long nthreads = (THREADS > 0) ? THREADS : std::max(1u, std::thread::hardware_concurrency());
+    std::vector<long> threads(numP);
+    MPI_Gather(&nthreads, 1, MPI_LONG, threads.data(), 1, MPI_LONG, 0, MPI_COMM_WORLD);
+
+    // Test mode: #files checked and #files with some corrupted blocks (master only)
+    size_t checkedFiles = 0, corruptedFiles = 0;
+    // #files the master could not write
+    size_t failedFiles = 0;
 
     // Start the timer
     MPI_Barrier(MPI_COMM_WORLD);
     double start_time = MPI_Wtime();
 
     if (!myId) {
-        // The master creates the blocks of data and their metadata ------------------------------------------------------------------------
-        std::vector<MetaBlock> metaBlocks;
-        std::vector<std::vector<char>> dataBlocks;
+        // The master reads the blocks of data, fills their metadata and sends them one by one ---------------------------------------------
+        // the master gets the files (that have size != 0) to process while it walks the input: each block is sent
+        // as soon as it is read, without waiting for the rest of the file or of the tree. Only to choose the block size from the input
+        // the whole input is listed first
+        // the blocks are processed by the threads of the workers: the block size is chosen for all of them
+        size_t workerThreads = 0;
+        for (int w = 1; w < numP; ++w) workerThreads += threads[w];
+
+        std::vector<std::pair<std::string, long>> files;
+        if (comp && AUTO_BLOCK) {
+            files = getFiles(start, argv, argc);
+
+            size_t totalBytes = 0, nfiles = 0;
+            for (const auto &[file, size] : files) {
+                if (discardIt(file.c_str(), true)) continue;
+                totalBytes += size;
+                ++nfiles;
+            }
+            BIGFILE_LOW_THRESHOLD = autoBlockSize(totalBytes, nfiles, workerThreads);
+            if (QUITE_MODE >= 1) {
+                std::cout << "Block size: " << BIGFILE_LOW_THRESHOLD / 1024 << " KB (" << nfiles << " files, " << totalBytes << " bytes, " << workerThreads << " worker threads)" << std::endl;
+            }
+        }
+        FileWalker walker(start, argv, argc, acceptFile, RECUR, QUITE_MODE);
+        size_t nfiles = 0; // files found
+
+        // next file to process with its size: from the list, or from the walk (the file is not stat-ed again)
+        auto nextFile = [&](std::string &file, long &size) {
+            if (comp && AUTO_BLOCK) {
+                if (nfiles == files.size()) return false;
+                file = files[nfiles].first;
+                size = files[nfiles].second;
+            } else if (!walker.next(file, size)) {
+                return false;
+            }
+            ++nfiles;
+            return true;
+        };
+
+        // The master gets the metadata and the data back from the workers, the Writer thread writes the files ----------------------------
+        size_t slots = 0;       // blocks outstanding at most, in all the workers
+        for (int w = 1; w < numP; ++w) slots += DEPTH * threads[w];
+        Writer writer(2 * slots);
+
+        // Test mode: nothing is written, only the results of the checks are kept
+        std::map<std::string, std::pair<size_t, bool>> checks; // key: filename, value: #blocks checked, no corrupted blocks
+
+        // Pull-based scheduling: a worker has at most DEPTH blocks outstanding per thread (sent, but with the result not back yet),
+        // and the result of a block is its request for the next one, so the faster workers get more blocks.
+        // The blocks are sent with MPI_Isend and kept until their result arrives: the master never blocks in a send,
+        // while a worker may be blocked sending a result back
+        struct InFlight {
+            MetaBlock meta;
+            std::vector<char> data;
+            MPI_Request requests[2];
+        };
+        size_t numWorkers = numP - 1;
+        std::vector<std::deque<InFlight>> inFlight(numWorkers + 1);  // per worker, in the order the blocks were sent
+        size_t worker = 0;
+        size_t sent = 0;        // blocks sent to the workers
+        size_t received = 0;    // results received from the workers
+
+        // the buffers of the blocks whose result is back are reused for the blocks read next: the master holds
+        // at most DEPTH blocks per worker thread, whatever the size of the files and of the input
+        std::vector<std::vector<char>> freeBuffers;
+        auto getBuffer = [&](size_t size) {
+            std::vector<char> buffer;
+            if (!freeBuffers.empty()) {
+                buffer = std::move(freeBuffers.back());
+                freeBuffers.pop_back();
+            }
+            buffer.resize(size);
+            return buffer;
+        };
 
-        // the master gets the files (that have size != 0) to process, and stores them in a vector called `files`
-        std::vector<std::string> files = getFiles(start, argv, argc);
+        // receive the result of a block from any worker, waiting for it
+        auto receiveBlock = [&]() {
+            // Receive the metadata
+            MetaBlock receivedMetaBlock;
+            MPI_Status status;
+            MPI_Recv(&receivedMetaBlock, 1, MPI_MetaBlock, MPI_ANY_SOURCE, 0, MPI_COMM_WORLD, &status);
 
-        if (QUITE_MODE >= 2) {
-            std::fprintf(stderr, "Master has %lu files to process\n", files.size());
-        }
-        
-        // the master creates the blocks and fills the MetaBlock structs
-        for (size_t i = 0; i < files.size(); i++) {
-            struct stat statbuf;
+            // Receive the data
+            std::vector<char> receivedData(receivedMetaBlock.cmp_size);
+            MPI_Recv(receivedData.data(), receivedData.size(), MPI_CHAR, status.MPI_SOURCE, 0, MPI_COMM_WORLD, &status);
 
-            if (stat(files[i].c_str(), &statbuf) == -1) {
-                std::perror("stat failed");
-                continue;
+            // the worker has got all its blocks up to this one (it receives them in order, even if its threads may
+            // finish them out of order): the oldest send is over and a slot is free
+            auto &pending = inFlight[status.MPI_SOURCE];
+            MPI_Waitall(2, pending.front().requests, MPI_STATUSES_IGNORE);
+            freeBuffers.push_back(std::move(pending.front().data));
+            pending.pop_front();
+            ++received;
+
+            if (VERIFY) {
+                auto &[checked, ok] = checks.try_emplace(receivedMetaBlock.filename, 0, true).first->second;
+                if (receivedMetaBlock.flags & BLOCK_CORRUPTED) ok = false;
+
+                // Last block of the file: report the result
+                if (++checked == receivedMetaBlock.nblocks) {
+                    ++checkedFiles;
+                    if (!ok) {
+                        ++corruptedFiles;
+                        if (QUITE_MODE >= 1) std::fprintf(stderr, "%s: corrupted\n", receivedMetaBlock.filename);
+                    } else if (QUITE_MODE >= 2) {
+                        std::fprintf(stderr, "%s: OK\n", receivedMetaBlock.filename);
+                    }
+                    checks.erase(receivedMetaBlock.filename);
+                }
+            } else {
+                // the Writer thread appends it to its file, or writes the file if it is the last block
+                writer.push(receivedMetaBlock, std::move(receivedData));
+            }
+
+            if (QUITE_MODE >= 2) {
+                std::fprintf(stderr, "Master received metadata block: size %zu, filename %s, cmp_size %zu, blockid %zu, nblocks %zu\n", receivedMetaBlock.size, receivedMetaBlock.filename, receivedMetaBlock.cmp_size, receivedMetaBlock.blockid, receivedMetaBlock.nblocks);
+                std::fprintf(stderr, "Master received data block: size %zu\n", receivedData.size());
+            }
+        };
+
+        // receive the results that have already arrived, without waiting
+        auto receiveReady = [&]() {
+            int flag = 0;
+            MPI_Iprobe(MPI_ANY_SOURCE, 0, MPI_COMM_WORLD, &flag, MPI_STATUS_IGNORE);
+            while (flag) {
+                receiveBlock();
+                MPI_Iprobe(MPI_ANY_SOURCE, 0, MPI_COMM_WORLD, &flag, MPI_STATUS_IGNORE);
+            }
+        };
+
+        // the worker with the fewest blocks outstanding per thread, starting from the one after the last used
+        auto leastLoaded = [&]() {
+            size_t best = 0;
+            for (size_t k = 0; k < numWorkers; ++k) {
+                const size_t w = (worker + k) % numWorkers + 1;
+                if (best == 0 || inFlight[w].size() * threads[best] < inFlight[best].size() * threads[w]) best = w;
+            }
+            return best;
+        };
+
+        // send a block just read: its metadata and its data, that stays in flight until the result is back
+        auto sendBlock = [&](const MetaBlock &block, std::vector<char> &&data) {
+            // if quiet >= 2 print the size of the metadata block and the size of the data block
+            if (QUITE_MODE >= 2) {
+                std::fprintf(stderr, "Metadata block %zu: size %zu, filename %s, cmp_size %zu, blockid %zu, nblocks %zu\n", sent, block.size, block.filename, block.cmp_size, block.blockid, block.nblocks);
+                std::fprintf(stderr, "Data block %zu: size %zu\n", sent, data.size());
+            }
+
+            // the results that are back give their slots to the next blocks
+            receiveReady();
+
+            // the blocks of a chained file to decompress go to the same worker, that keeps the end of each block for the next one
+            auto full = [&](size_t w) { return inFlight[w].size() >= (size_t)(DEPTH * threads[w]); };
+            if (comp || !(block.flags & BLOCK_DICT) || block.blockid == 1) {
+                for (worker = leastLoaded(); full(worker); worker = leastLoaded()) {
+                    receiveBlock(); // all the workers are busy: wait for the first one that is done
+                }
+            } else {
+                while (full(worker)) receiveBlock();
             }
 
-            if (comp) { // Compression: split the files into blocks depending on BIGFILE_LOW_THRESHOLD
+            InFlight &f = inFlight[worker].emplace_back();
+            f.meta = block;
+            f.data = std::move(data);
+
+            // Send the metadata
+            MPI_Isend(&f.meta, 1, MPI_MetaBlock, worker, 0, MPI_COMM_WORLD, &f.requests[0]);
+
+            // Send the data
+            MPI_Isend(f.data.data(), f.data.size(), MPI_CHAR, worker, 0, MPI_COMM_WORLD, &f.requests[1]);
+            ++sent;
+        };
+
+        // a block that cannot be read (a recycled buffer would be sent with the bytes of another file): it is false
+        // for the first block of a file, that is skipped, while the run is aborted if some blocks of the file have
+        // already been sent, since they cannot be taken back
+        auto readOk = [&](std::istream &inFile, const std::string &file, const MetaBlock &block, std::vector<char> &buffer) {
+            if (inFile && (size_t)inFile.gcount() == buffer.size()) return true;
+            std::cerr << "Error reading file: " << file << std::endl;
+            if (block.blockid > 1) MPI_Abort(MPI_COMM_WORLD, -1);
+            freeBuffers.push_back(std::move(buffer));
+            return false;
+        };
+
+        // the master reads the blocks of each file, fills the MetaBlock structs and sends them
+        std::string file;
+        long fileSize;
+        while (nextFile(file, fileSize)) {
+            if (comp) { // Compression: split the files into blocks depending on BIGFILE_LOW_THRESHOLD (or on the per-file block size)
 
                 // Check if the file is already compressed (.zip)
-                if (discardIt(files[i].c_str(), true)) {
+                if (discardIt(file.c_str(), true)) {
                     if (QUITE_MODE >= 2) {
-                        std::fprintf(stderr, "%s has already a %s suffix -- ignored\n", files[i].c_str(), SUFFIX);
+                        std::fprintf(stderr, "%s has already a %s suffix -- ignored\n", file.c_str(), outSuffix());
                     }
                     continue;
                 }
 
-                size_t size = statbuf.st_size;
+                size_t size = fileSize;
 
-                if (size <= BIGFILE_LOW_THRESHOLD) { // Single block file
+                // block size of this file
+                const size_t bs = fileBlockSize(size, workerThreads);
+                if (AUTO_BLOCK == 2 && QUITE_MODE >= 2) {
+                    std::fprintf(stderr, "Master uses blocks of %zu KB for file %s\n", bs / 1024, file.c_str());
+                }
+
+                if (size <= bs) { // Single block file
                     // Create a MetaBlock struct
                     MetaBlock block;
                     block.size = size;
-                    std::strcpy(block.filename, files[i].c_str());
+                    std::strcpy(block.filename, file.c_str());
                     block.cmp_size = 0;
+                    block.flags = 0;
+                    block.crc = 0;
+                    block.dict = 0;
                     block.blockid = 1;
                     block.nblocks = 1;
-                    // Add metadata to metaBlocks
-                    metaBlocks.push_back(block);
 
                     // Read data into a buffer
-                    std::vector<char> buffer(size);
-                    std::ifstream inFile(files[i], std::ios::binary);
-                    if (inFile) {
-                        inFile.read(buffer.data(), size);
-                        inFile.close();
-                    }
-                    // Add data to dataBlocks
-                    dataBlocks.push_back(buffer);
+                    std::vector<char> buffer = getBuffer(size);
+                    std::ifstream inFile(file, std::ios::binary);
+                    inFile.read(buffer.data(), size);
+                    if (!readOk(inFile, file, block, buffer)) continue;
+                    inFile.close();
+                    sendBlock(block, std::move(buffer));
 
                 } else { // Multiple blocks file
-                    const size_t fullblocks = size / BIGFILE_LOW_THRESHOLD;
-                    const size_t partialblock = size % BIGFILE_LOW_THRESHOLD;
+                    const size_t fullblocks = size / bs;
+                    const size_t partialblock = size % bs;
 
-                    std::ifstream inFile(files[i], std::ios::binary);
+                    std::ifstream inFile(file, std::ios::binary);
 
                     if (!inFile) {
-                        std::cerr << "Error opening file: " << files[i] << std::endl;
+                        std::cerr << "Error opening file: " << file << std::endl;
                         continue;
                     }
-                    
+
+                    bool skip = false;
                     for (size_t j = 0; j < fullblocks; ++j) {
                         // Create a MetaBlock struct
                         MetaBlock block;
-                        block.size = BIGFILE_LOW_THRESHOLD;
-                        std::strcpy(block.filename, files[i].c_str());
+                        block.size = bs;
+                        std::strcpy(block.filename, file.c_str());
                         block.cmp_size = 0;
+                        block.flags = CHAIN ? BLOCK_DICT : 0;
+                        block.crc = 0;
+                        block.dict = CHAIN ? dictLen(j * bs) : 0;
                         block.blockid = j + 1;
                         block.nblocks = fullblocks + (partialblock > 0);
-                        // Add metadata to metaBlocks
-                        metaBlocks.push_back(block);
 
                         // Read data into a buffer: only the data relative to the block!
-                        std::vector<char> buffer(BIGFILE_LOW_THRESHOLD);
-
-                        inFile.read(buffer.data(), BIGFILE_LOW_THRESHOLD);
+                        // (a chained block is preceded by the end of the previous one, read again from the file)
+                        std::vector<char> buffer = getBuffer(block.dict + bs);
+                        if (block.dict) inFile.seekg(j * bs - block.dict);
+                        inFile.read(buffer.data(), block.dict + bs);
+                        if (!readOk(inFile, file, block, buffer)) {
+                            skip = true;
+                            break;
+                        }
 
                         if (QUITE_MODE >= 2) {
                             std::fprintf(stderr, "Buffer size: %zu\n", buffer.size());
                         }
 
-                        // Add data to dataBlocks
-                        dataBlocks.push_back(buffer);
+                        sendBlock(block, std::move(buffer));
                     }
+                    if (skip) continue;
                     if (partialblock) {
                         // Create a MetaBlock struct
                         MetaBlock block;
                         block.size = partialblock;
-                        std::strcpy(block.filename, files[i].c_str());
+                        std::strcpy(block.filename, file.c_str());
                         block.cmp_size = 0;
+                        block.flags = CHAIN ? BLOCK_DICT : 0;
+                        block.crc = 0;
+                        block.dict = CHAIN ? dictLen(fullblocks * bs) : 0;
                         block.blockid = fullblocks + 1;
                         block.nblocks = fullblocks + 1;
-                        // Add metadata to metaBlocks
-                        metaBlocks.push_back(block);
 
                         // Read data into a buffer: only the data relative to the block!
-                        std::vector<char> buffer(partialblock);
-                        inFile.read(buffer.data(), partialblock);
+                        std::vector<char> buffer = getBuffer(block.dict + partialblock);
+                        if (block.dict) inFile.seekg(fullblocks * bs - block.dict);
+                        inFile.read(buffer.data(), block.dict + partialblock);
+                        if (!readOk(inFile, file, block, buffer)) continue;
 
                         if(QUITE_MODE >= 2){
                             std::fprintf(stderr, "Buffer size: %zu\n", buffer.size());
                         }
                         
-                        // Add data to dataBlocks
-                        dataBlocks.push_back(buffer);
+                        sendBlock(block, std::move(buffer));
                     }
                     inFile.close();
                 }
             } else { // Decompression: split the files into blocks depending on the header
 
                 // Check if the file isn't a compressed file (no .zip)
-                if (discardIt(files[i].c_str(), false)) {
+                if (discardIt(file.c_str(), false)) {
                     if (QUITE_MODE >= 2) {
-                        std::fprintf(stderr, "%s does not have a %s suffix -- ignored\n", files[i].c_str(), SUFFIX);
+                        std::fprintf(stderr, "%s does not have a %s suffix -- ignored\n", file.c_str(), SUFFIX);
                     }
                     continue;
                 }
 
-                std::fstream inFile(files[i], std::ios::binary | std::ios::in);
+                std::fstream inFile(file, std::ios::binary | std::ios::in);
 
                 if (!inFile) {
-                    std::cerr << "Error opening file: " << files[i] << std::endl;
+                    std::cerr << "Error opening file: " << file << std::endl;
                     continue;
                 }
 
-                // Read the first 8 bytes to determine if it was a small or big file (magic header)
-                size_t nblocks;
-                
-                inFile.read(reinterpret_cast<char*>(&nblocks), sizeof(size_t));
-
-                if (QUITE_MODE >= 2) {
-                    //std::fprintf(stderr, "Decompressing file %s with %zu blocks\n", files[i].c_str(), nblocks);
-                    std::cout << "Decompressing file " << files[i] << " with " << nblocks << " blocks" << std::endl; 
+                // Read the block index (header or trailer, depending on the format)
+                std::vector<BlockIndex> index;
+                if (!readIndex(inFile, fileSize, index) || index.empty()) {
+                    std::cerr << "Not a valid compressed file: " << file << std::endl;
+                    if (VERIFY) {
+                        ++checkedFiles;
+                        ++corruptedFiles;
+                    }
+                    continue;
                 }
+                size_t nblocks = index.size();
 
-                // Retrieve the original and compressed sizes of the blocks
-                std::vector<size_t> Sizes(nblocks);
-                std::vector<size_t> cmpSizes(nblocks);
-                for (size_t j = 0; j < nblocks; ++j) {
-                    inFile.read(reinterpret_cast<char*>(&Sizes[j]), sizeof(size_t));
-                    inFile.read(reinterpret_cast<char*>(&cmpSizes[j]), sizeof(size_t));
+                if (QUITE_MODE >= 2) {
+                    //std::fprintf(stderr, "Decompressing file %s with %zu blocks\n", file.c_str(), nblocks);
+                    std::cout << "Decompressing file " << file << " with " << nblocks << " blocks" << std::endl; 
                 }
 
-                // For each block, create a MetaBlock struct and add it to metaBlocks, and read the data into a buffer and add it to dataBlocks
+                // For each block, create a MetaBlock struct, read the data into a buffer and send them
+                size_t outOffset = 0; // offset of each block in the decompressed file
                 for (size_t j = 0; j < nblocks; ++j) {
                     // Create a MetaBlock struct
                     MetaBlock block;
-                    block.size = cmpSizes[j]; // the size of the block is the compressed size
-                    std::strcpy(block.filename, files[i].c_str());
-                    block.cmp_size = Sizes[j];
+                    block.size = index[j].cmp_size; // the size of the block is the compressed size
+                    std::strcpy(block.filename, file.c_str());
+                    block.cmp_size = index[j].size;
+                    block.flags = index[j].flags;
+                    block.crc = index[j].crc;
+                    block.dict = (index[j].flags & BLOCK_DICT) ? dictLen(outOffset) : 0;
+                    outOffset += index[j].size;
                     block.blockid = j + 1;
                     block.nblocks = nblocks;
-                    // Add metadata to metaBlocks
-                    metaBlocks.push_back(block);
 
                     // Read data into a buffer: only the data relative to the block!
-                    std::vector<char> buffer(cmpSizes[j]);
-                    inFile.read(buffer.data(), cmpSizes[j]);
-                    // Add data to dataBlocks
-                    dataBlocks.push_back(buffer);
+                    std::vector<char> buffer = getBuffer(index[j].cmp_size);
+                    inFile.seekg(index[j].offset);
+                    inFile.read(buffer.data(), index[j].cmp_size);
+                    if (!readOk(inFile, file, block, buffer)) {
+                        if (VERIFY) {
+                            ++checkedFiles;
+                            ++corruptedFiles;
+                        }
+                        break;
+                    }
+                    sendBlock(block, std::move(buffer));
                 }
                 inFile.close();
             }
@@ -258,203 +872,112 @@ int main(int argc, char *argv[]) {
         }
 
         if (QUITE_MODE >= 2) {
-            std::fprintf(stderr, "Master has created %lu meta blocks\n", metaBlocks.size());
-        }
-        if (QUITE_MODE >= 2) {
-            std::fprintf(stderr, "Master has created %lu data blocks\n", dataBlocks.size());
-        }
-
-        // if quiet >= 2 print the sizes of each metadata block and the sizes of each data block
-        if (QUITE_MODE >= 2) {
-            for (size_t i = 0; i < metaBlocks.size(); ++i) {
-                std::fprintf(stderr, "Metadata block %zu: size %zu, filename %s, cmp_size %zu, blockid %zu, nblocks %zu\n", i, metaBlocks[i].size, metaBlocks[i].filename, metaBlocks[i].cmp_size, metaBlocks[i].blockid, metaBlocks[i].nblocks);
-            }
-            for (size_t i = 0; i < dataBlocks.size(); ++i) {
-                std::fprintf(stderr, "Data block %zu: size %zu\n", i, dataBlocks[i].size());
-            }
-        }
-
-        // The master sends the metadata and the data to the other processes in a round robin fashion --------------------------------------
-        size_t numWorkers = numP - 1;
-
-        for (size_t i = 0; i < metaBlocks.size(); ++i) {
-            size_t worker = i % numWorkers + 1;
-
-            // Send the metadata
-            MPI_Send(&metaBlocks[i], 1, MPI_MetaBlock, worker, 0, MPI_COMM_WORLD);
-
-            // Send the data
-            MPI_Send(dataBlocks[i].data(), dataBlocks[i].size(), MPI_CHAR, worker, 0, MPI_COMM_WORLD);
-        }
-
-        // Send termination message to all workers
-        for (int dest = 1; dest <= numWorkers; ++dest) {
-            MetaBlock terminationMeta;
-            terminationMeta.size = -1; // Use -1 to indicate no more work
-            MPI_Send(&terminationMeta, 1, MPI_MetaBlock, dest, 0, MPI_COMM_WORLD);
+            std::fprintf(stderr, "Master has sent %zu blocks of %zu files\n", sent, nfiles);
         }
 
-        // The master gets the metadata and the data back from the workers ----------------------------------------------------------------
-        std::map<std::string, std::vector<std::pair<MetaBlock, std::vector<char>>>> filesMap;
-
-        // Receive all metadata and data from workers
-        for (size_t i = 0; i < metaBlocks.size(); ++i) {
-            // Receive the metadata
-            MetaBlock receivedMetaBlock;
-            MPI_Status status;
-            MPI_Recv(&receivedMetaBlock, 1, MPI_MetaBlock, MPI_ANY_SOURCE, 0, MPI_COMM_WORLD, &status);
-
-            // Receive the data
-            std::vector<char> receivedData(receivedMetaBlock.cmp_size);
-            MPI_Recv(receivedData.data(), receivedData.size(), MPI_CHAR, status.MPI_SOURCE, 0, MPI_COMM_WORLD, &status);
-
-            // Add the metadata and the data to the map
-            filesMap[receivedMetaBlock.filename].push_back({receivedMetaBlock, receivedData});
-
-            if (QUITE_MODE >= 2) {
-                std::fprintf(stderr, "Master received metadata block: size %zu, filename %s, cmp_size %zu, blockid %zu, nblocks %zu\n", receivedMetaBlock.size, receivedMetaBlock.filename, receivedMetaBlock.cmp_size, receivedMetaBlock.blockid, receivedMetaBlock.nblocks);
-                std::fprintf(stderr, "Master received data block: size %zu\n", receivedData.size());
-            }
+        // Send termination message to all workers, after their last blocks
+        std::vector<MetaBlock> terminationMeta(numWorkers + 1);
+        std::vector<MPI_Request> terminationRequests(numWorkers + 1, MPI_REQUEST_NULL);
+        for (size_t dest = 1; dest <= numWorkers; ++dest) {
+            terminationMeta[dest].size = -1; // Use -1 to indicate no more work
+            MPI_Isend(&terminationMeta[dest], 1, MPI_MetaBlock, dest, 0, MPI_COMM_WORLD, &terminationRequests[dest]);
         }
 
-        // Save the processed data to files ------------------------------------------------------------------------------------------------
-        for (auto& [filename, pairs] : filesMap) {
-
-            if (QUITE_MODE >= 2) {
-                std::fprintf(stderr, "Master has %lu pairs of (MetaBlock, data) for file %s\n", pairs.size(), filename.c_str());
-            }
+        // Receive the results still outstanding
+        while (received < sent) receiveBlock();
+        MPI_Waitall(terminationRequests.size(), terminationRequests.data(), MPI_STATUSES_IGNORE);
+        writer.close();
+        failedFiles = writer.failures();
 
-            // Sort the pairs by blockid
-            std::sort(pairs.begin(), pairs.end(), [](const std::pair<MetaBlock, std::vector<char>>& a, const std::pair<MetaBlock, std::vector<char>>& b) {
-                return a.first.blockid < b.first.blockid;
-            });
-
-            // Determine the output filename
-            std::string outputFilename;
-            if (comp) {
-                outputFilename = filename + SUFFIX;
+    } else {
+        // The workers receive the metadata and the data from the master -------------------------------------------------------------------
+        // The main thread receives the blocks and sends the results back, the threads of the pool process them.
+        // The master sends metadata, data, metadata, data, ... with the same tag: the receives are posted in that order
+        WorkerPool pool(nthreads, myId);
+
+        struct Result {
+            MetaBlock meta;
+            std::vector<char> data;
+            MPI_Request requests[2];
+        };
+        std::deque<Result> sending;     // results being sent (MPI_Isend), oldest first
+        MetaBlock nextMeta;             // metadata of the next block (a termination message if its size is -1)
+        MPI_Request nextRequest = MPI_REQUEST_NULL, dataRequest = MPI_REQUEST_NULL;
+        Block incoming;                 // the block whose data is being received
+        size_t held = 0;                // blocks received and not sent back yet
+        size_t inPool = 0;              // blocks given to the threads and not taken back yet
+        const size_t capacity = DEPTH * nthreads; // blocks the master sends ahead to this worker
+        bool last = false;
+
+        // receive the next message of the master (the metadata or the data of a block), waiting for it if wait,
+        // it returns true if something has arrived
+        auto receive = [&](bool wait) {
+            const bool data = (dataRequest != MPI_REQUEST_NULL);
+            MPI_Request &request = data ? dataRequest : nextRequest;
+            int arrived = 1;
+            if (wait) MPI_Wait(&request, MPI_STATUS_IGNORE);
+            else      MPI_Test(&request, &arrived, MPI_STATUS_IGNORE);
+            if (!arrived) return false;
+
+            if (data) {
+                // the data of a block: it goes to the threads, and the metadata of the next one can be received
+                pool.push(std::move(incoming));
+                ++inPool;
+                MPI_Irecv(&nextMeta, 1, MPI_MetaBlock, 0, 0, MPI_COMM_WORLD, &nextRequest);
+            } else if (nextMeta.size == -1) {
+                last = true;
             } else {
-                outputFilename = filename.substr(0, filename.size() - strlen(SUFFIX));
-            }
-
-            // Create the output file
-            std::ofstream outFile(outputFilename, std::ios::binary);
-
-            if (!outFile) {
-                std::cerr << "Error opening file for writing: " << filename << std::endl;
-                continue;
-            }
-
-            if (comp) { // Write the header in the compressed file
-                size_t nblocks = pairs[0].first.nblocks;
-                outFile.write(reinterpret_cast<char*>(&nblocks), sizeof(size_t));
-
-                for (const auto& [metaBlock, _] : pairs) {
-                    outFile.write(reinterpret_cast<const char*>(&metaBlock.size), sizeof(size_t));
-                    outFile.write(reinterpret_cast<const char*>(&metaBlock.cmp_size), sizeof(size_t));
-                }
-            }
-
-            // Write the data
-            for (const auto& [_, data] : pairs) {
-                outFile.write(data.data(), data.size());
+                incoming.meta = nextMeta;
+                // compression: a chained block is preceded by its dictionary
+                incoming.data.resize(comp ? nextMeta.dict + nextMeta.size : nextMeta.size);
+                MPI_Irecv(incoming.data.data(), incoming.data.size(), MPI_CHAR, 0, 0, MPI_COMM_WORLD, &dataRequest);
+                ++held;
             }
-
-            outFile.close(); 
-
-            // Remove original file if flag is set
-            if (REMOVE_ORIGIN) {
-                unlink(filename.c_str());
+            return true;
+        };
+
+        MPI_Irecv(&nextMeta, 1, MPI_MetaBlock, 0, 0, MPI_COMM_WORLD, &nextRequest);
+        while (!last || held > 0) {
+            bool busy = !last && receive(false);
+
+            // Send the metadata and the data of the results back to the master: each one is also the request for another block
+            Block block;
+            while (pool.pop(block)) {
+                if (!block.ok) MPI_Abort(MPI_COMM_WORLD, -1);
+                Result &result = sending.emplace_back();
+                result.meta = block.meta;
+                result.data = std::move(block.data);
+                MPI_Isend(&result.meta, 1, MPI_MetaBlock, 0, 0, MPI_COMM_WORLD, &result.requests[0]);
+                MPI_Isend(result.data.data(), result.data.size(), MPI_CHAR, 0, 0, MPI_COMM_WORLD, &result.requests[1]);
+                --held;
+                --inPool;
+                busy = true;
             }
-        }
-    } else {
-        // The workers receive the metadata and the data from the master -------------------------------------------------------------------
-        while (true) {
-            // First probe for the message
-            MPI_Status status;
-            MPI_Probe(0, MPI_ANY_TAG, MPI_COMM_WORLD, &status); // Probe for a message from rank 0
-
-            // Allocate memory for the MetaBlock
-            MetaBlock receivedMetaBlock;
-            // Receive the MetaBlock
-            MPI_Recv(&receivedMetaBlock, 1, MPI_MetaBlock, 0, 0, MPI_COMM_WORLD, &status);
-
-            // Check if the termination message was received
-            if (receivedMetaBlock.size == -1) break;
-
-            // Now that we have the metadata, we can proceed to receive the data
-            std::vector<char> receivedData(receivedMetaBlock.size);
-            // Receive the data block
-            MPI_Recv(receivedData.data(), receivedData.size(), MPI_CHAR, 0, 0, MPI_COMM_WORLD, &status);
-
-            if (QUITE_MODE >= 2) {
-                std::fprintf(stderr, "Worker %d received metadata block: size %zu, filename %s, cmp_size %zu, blockid %zu, nblocks %zu\n", myId, receivedMetaBlock.size, receivedMetaBlock.filename, receivedMetaBlock.cmp_size, receivedMetaBlock.blockid, receivedMetaBlock.nblocks);
-                std::fprintf(stderr, "Worker %d received data block: size %zu\n", myId, receivedData.size());
+            while (!sending.empty()) {
+                int over = 0;
+                MPI_Testall(2, sending.front().requests, &over, MPI_STATUSES_IGNORE);
+                if (!over) break;
+                sending.pop_front();
             }
-
-            // Process the data block (compress or decompress) -----------------------------------------------------------------------------
-            size_t size = receivedMetaBlock.size;
-            size_t cmp_size = receivedMetaBlock.cmp_size;
-
-            std::vector<char> sendData;
-
-            if (comp) { 
-                // get an estimation of the maximum compression size
-                unsigned long cmp_len = compressBound(size);
-
-                // allocate memory to store compressed data in memory
-                unsigned char *ptrOut = new unsigned char[cmp_len];
-
-                // compress the data
-                if (compress(ptrOut, &cmp_len, reinterpret_cast<unsigned char*>(receivedData.data()), size) != Z_OK) {
-                    std::cerr << "Process " << myId << " failed to compress the data" << std::endl;
-                    delete [] ptrOut;
-                    MPI_Abort(MPI_COMM_WORLD, -1);
-                }
-
-                if (QUITE_MODE >= 2) {
-                    std::fprintf(stderr, "Worker %d has compressed the block %zu of file %s.\n", myId, receivedMetaBlock.blockid, receivedMetaBlock.filename);
-                }
-
-                // update cmp_size to cmp_len in receivedMetaBlock and save compressed data in the sendData vector
-                receivedMetaBlock.cmp_size = cmp_len;
-                sendData.resize(cmp_len);
-                std::memcpy(sendData.data(), ptrOut, cmp_len);
-                delete [] ptrOut;
-
+            if (busy) continue;
+
+            // Nothing has happened: block on what can bring something, instead of polling
+            if (inPool == 0 || (!last && inPool < (size_t)nthreads && held < capacity)) {
+                // the threads have nothing to do, or some of them are idle and the master can send more blocks:
+                // wait for the master (MPI_Wait also lets the sends of the results go on)
+                receive(true);
+            } else if (!sending.empty()) {
+                // the threads are busy and no block is needed now: the oldest result goes to the master first,
+                // that may be waiting for it
+                MPI_Waitall(2, sending.front().requests, MPI_STATUSES_IGNORE);
+                sending.pop_front();
             } else {
-                // allocate memory to store decompressed data in memory (cmp_size is the size of the original block)
-                unsigned char *ptrOut = new unsigned char[cmp_size];
-
-                // decompress the data
-                if (uncompress(ptrOut, &cmp_size, reinterpret_cast<unsigned char*>(receivedData.data()), size) != Z_OK) {
-                    std::cerr << "Process " << myId << " failed to decompress the data" << std::endl;
-                    delete [] ptrOut;
-                    MPI_Abort(MPI_COMM_WORLD, -1);
-                }
-
-                if (QUITE_MODE >= 2) {
-                    std::fprintf(stderr, "Worker %d has decompressed the block %zu of file %s.\n", myId, receivedMetaBlock.blockid, receivedMetaBlock.filename);
-                }
-
-                // save decompressed data in the sendData vector
-                sendData.resize(cmp_size);
-                std::memcpy(sendData.data(), ptrOut, cmp_size);
-                delete [] ptrOut;
+                // only the threads can bring something: wait for a result
+                pool.wait();
             }
-
-            // Store the metadata and the data in a pair
-            std::pair<MetaBlock, std::vector<char>> pair = {receivedMetaBlock, sendData};
-
-            // Add the pair to the pairs vector
-            pairs.push_back(pair);
-        }
-
-        // Send the metadata and the data in pairs back to the master ----------------------------------------------------------------------
-        for (const auto& [metaBlock, data] : pairs) {
-            MPI_Send(&metaBlock, 1, MPI_MetaBlock, 0, 0, MPI_COMM_WORLD);
-            MPI_Send(data.data(), data.size(), MPI_CHAR, 0, 0, MPI_COMM_WORLD);
         }
+        for (auto &result : sending) MPI_Waitall(2, result.requests, MPI_STATUSES_IGNORE);
+        pool.close();
     }
 
     // Stop the timer
@@ -463,8 +986,14 @@ int main(int argc, char *argv[]) {
     // Calculate and display the elapsed time in seconds
     if(!myId){
     	std::cout << "Elapsed time: " << end_time - start_time << " s\n" << std::endl;
+        if (VERIFY) {
+            std::cout << "Checked " << checkedFiles << " files, " << corruptedFiles << " corrupted\n";
+        }
+        if (failedFiles > 0) {
+            std::cerr << failedFiles << " files could not be written" << std::endl;
+        }
 	}
 
     MPI_Finalize();
-    return 0;
+    return (corruptedFiles > 0 || failedFiles > 0) ? 1 : 0;
 }
\ No newline at end of file
@@ -18,46 +18,55 @@ this file was built on top of the utility.hpp file from the ffc folder
 #include <fstream>
 
 #include <algorithm>
+#include <cmath>
 #include <string>
 #include <stdexcept>
 
 #include <../miniz/miniz.h>
+#include <../common/filewalker.hpp>
+#include <../common/format.hpp>
+#include <../common/codec.hpp>
+#include <../common/blocksize.hpp>
 
 
-#define SUFFIX ".zip"
 #define BUF_SIZE (1024 * 1024)
 
 // global variables with their default values ---------------------------------------------------
 static bool comp = true;                        // by default, it compresses 
-static size_t BIGFILE_LOW_THRESHOLD = 2097152;  // 2Mbytes threshold
 static bool REMOVE_ORIGIN = false;              // Does it keep the origin file?
 static int  QUITE_MODE = 1;                     // 0 silent, 1 only errors, 2 everything
 static bool RECUR = false;                      // do we have to process the contents of subdirs?
+static int  FORMAT = 2;                         // container format written when compressing (1, 2 or 3)
+static int  LEVEL = MZ_DEFAULT_LEVEL;           // compression level (0..10)
+static int  STRATEGY = MZ_DEFAULT_STRATEGY;     // deflate strategy (MZ_DEFAULT_STRATEGY, MZ_FILTERED, MZ_HUFFMAN_ONLY, MZ_RLE, MZ_FIXED)
+static bool PROBE = true;                       // store the incompressible blocks as they are (format 2 only)
+static bool VERIFY = false;                     // test mode: decompress and check the blocks, nothing is written
+static bool CHAIN = false;                      // prime each block with the end of the previous one (format 2 or 3)
+static long DEPTH = 2;                          // blocks outstanding per worker thread: it asks for more by sending back the results
+static long THREADS = 1;                        // threads of each worker that process its blocks (0: all the cores of its node)
 // ----------------------------------------------------------------------------------------------
 
 
-// check if the string 's' is a number, otherwise it returns false
-static bool isNumber(const char* s, long &n) {
-    try {
-		size_t e;
-		n=std::stol(s, &e, 10);
-		return e == strlen(s);
-    } catch (const std::invalid_argument&) {
-		return false;
-    } catch (const std::out_of_range&) {
-		return false;
-    }
+// suffix of the files written when compressing
+static inline const char *outSuffix() {
+    return FORMAT == 3 ? GZ_SUFFIX : SUFFIX;
+}
+
+// true if the block looks incompressible and has to be stored as it is (format 2 only)
+static inline bool incompressible(const unsigned char *ptr, size_t size) {
+    return PROBE && FORMAT == 2 && LEVEL > 0 && sampleEntropy(ptr, size) > ENTROPY_THRESHOLD;
 }
 
-// If compdecomp is true (we are compressing), it checks if fname has the suffix SUFFIX,
+// If compdecomp is true (we are compressing), it checks if fname has the suffix outSuffix(),
 // if yes it returns true
 // If compdecomp is false (we are decompressing), it checks if fname has the suffix SUFFIX,
 // if yes it returns false
 static inline bool discardIt(const char *fname, const bool compdecomp) {
-    const int lensuffix=strlen(SUFFIX);
+    const char *suffix = compdecomp ? outSuffix() : SUFFIX;
+    const int lensuffix=strlen(suffix);
     const int len      = strlen(fname);
     if (len>lensuffix &&
-		(strncmp(&fname[len-lensuffix], SUFFIX, lensuffix)==0)) {
+		(strncmp(&fname[len-lensuffix], suffix, lensuffix)==0)) {
 		return compdecomp; // true or false depends on we are compressing or decompressing;
     }
     return !compdecomp;
@@ -67,91 +76,24 @@ static inline bool discardIt(const char *fname, const bool compdecomp) {
 Added by me 
 ------------------------------------------------------------------------------------------------------------------------------------------------*/
 
-// Function to get files in a directory (recursively or not, depending on RECUR flag)
-std::vector<std::string> getFilesInDir(const std::string &dirPath, bool RECUR) {
-    std::vector<std::string> files;
-    DIR *dir = opendir(dirPath.c_str());
-
-    if (!dir) {
-        std::cerr << "Error opening directory: " << dirPath << std::endl;
-        return files; // Return an empty list on failure
-    }
-
-    struct dirent *entry;
-    while ((entry = readdir(dir)) != nullptr) {
-        std::string fileName = entry->d_name;
-        std::string fullPath = dirPath + "/" + fileName;
-
-        // Skip "." and ".." directories
-        if (fileName == "." || fileName == "..") {
-            continue;
-        }
-
-        // Skip ".DS_Store" files
-        if (fileName == ".DS_Store") {
-            continue;
-        }
-
-        struct stat statbuf;
-        if (stat(fullPath.c_str(), &statbuf) == -1) {
-            continue; // Skip if stat fails
-        }
-
-        if (S_ISDIR(statbuf.st_mode)) {
-            // If it's a directory and RECUR is true, recurse into the directory
-            if (RECUR) {
-                std::vector<std::string> subdirFiles = getFilesInDir(fullPath, RECUR);
-                files.insert(files.end(), subdirFiles.begin(), subdirFiles.end());
-            }
-        } else {
-            // It's a file, add it to the list, if it's not empty
-            if (statbuf.st_size != 0) {
-                files.push_back(fullPath);
-            }
+// Function to check a file without reading it, given its size: the files of size 0 are skipped
+static bool acceptFile(const std::string &file, long size) {
+    if (size == 0) {
+        if (QUITE_MODE >= 2) {
+            std::fprintf(stderr, "%s has size 0 -- ignored\n", file.c_str());
         }
+        return false;
     }
-    closedir(dir); // Close the directory after processing
-
-    return files;
+    return true;
 }
 
 
-// Function to get the files to process from the command line arguments
-static std::vector<std::string> getFiles(long start, char *argv[], int argc) {
-	std::vector<std::string> inputFiles;
-	for (int i = start; i < argc; ++i) {
-		struct stat statbuf; // retrieves metadata about a file, including its size, without reading the file's content
-
-        if (stat(argv[i], &statbuf) == -1) {
-            std::perror("stat failed");
-            continue; 
-        }
-
-		// Check if it is a directory
-		if (S_ISDIR(statbuf.st_mode)) {
-            if (QUITE_MODE >= 2) {
-                std::fprintf(stderr, "%s is a directory\n", argv[i]);
-            }
-
-			// Get all the files in the dir (depending on RECUR, get also the files in the subdirs)
-			std::vector<std::string> files = getFilesInDir(argv[i], RECUR);
-
-			// Add these files to the inputFiles vector
-			for (const auto &file : files) {
-				inputFiles.push_back(file);
-			}
-
-            continue;
-		} else { // argv[i] is a file, add it to the inputFiles vector
-            // check if the file has size 0, if so, skip it
-            if (statbuf.st_size == 0) {
-                if (QUITE_MODE >= 2) {
-                    std::fprintf(stderr, "%s has size 0 -- ignored\n", argv[i]);
-                }
-                continue;
-            }
-			inputFiles.push_back(argv[i]);	
-        }
-	}
-	return inputFiles;
+// Function to get all the files to process with their sizes (largest first within the look-ahead window of FileWalker)
+static std::vector<std::pair<std::string, long>> getFiles(long start, char *argv[], int argc) {
+    std::vector<std::pair<std::string, long>> inputFiles;
+    FileWalker walker(start, argv, argc, acceptFile, RECUR, QUITE_MODE);
+    std::string file;
+    long size = 0;
+    while (walker.next(file, size)) inputFiles.emplace_back(file, size);
+    return inputFiles;
 }
\ No newline at end of file
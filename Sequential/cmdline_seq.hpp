@@ -18,12 +18,15 @@ static inline void usage(const char *argv0) {
     std::printf(" -C compress: 0 preserves, 1 removes the original file (default C=%d)\n", REMOVE_ORIGIN ? 1 : 0);
     std::printf(" -D decompress: 0 preserves, 1 removes the original file (default D=%d)\n", REMOVE_ORIGIN ? 1 : 0);
     std::printf(" -q 0 silent mode, 1 prints only error messages to stderr, 2 verbose (default q=%d)\n", QUITE_MODE ? 1 : 0);
+    std::printf(" -L compression level, from 0 (no compression) to 10 (best) (default L=%d)\n", LEVEL);
+    std::printf(" -S deflate strategy: 0 default, 1 filtered, 2 huffman only, 3 rle, 4 fixed (default S=%d)\n", STRATEGY);
+    std::printf(" -f format of the compressed files: 0 zlib stream, 3 gzip (.gz, for gzip -d) (default f=%d)\n", FORMAT);
     std::printf("--------------------\n");
 }
 
 int parseCommandLine(int argc, char *argv[]) {
     extern char *optarg;
-    const std::string optstr="R:C:D:q:";
+    const std::string optstr="R:C:D:q:L:S:f:";
     
     long opt, start = 1;
     bool cpresent = false, dpresent = false; // flags for the presence of -C and -D
@@ -73,6 +76,36 @@ int parseCommandLine(int argc, char *argv[]) {
                 QUITE_MODE = q;
                 start += 2; 
             } break;
+            case 'L': {
+                long l = 0;
+                if (!isNumber(optarg, l) || l < 0 || l > 10) {
+                    std::fprintf(stderr, "Error: wrong '-L' option, the level goes from 0 to 10\n");
+                    usage(argv[0]);
+                    return -1;
+                }
+                LEVEL = l;
+                start += 2;
+            } break;
+            case 'S': {
+                long st = 0;
+                if (!isNumber(optarg, st) || st < MZ_DEFAULT_STRATEGY || st > MZ_FIXED) {
+                    std::fprintf(stderr, "Error: wrong '-S' option, the strategy goes from 0 to 4\n");
+                    usage(argv[0]);
+                    return -1;
+                }
+                STRATEGY = st;
+                start += 2;
+            } break;
+            case 'f': {
+                long f = 0;
+                if (!isNumber(optarg, f) || (f != 0 && f != 3)) {
+                    std::fprintf(stderr, "Error: wrong '-f' option, the format can be 0 or 3\n");
+                    usage(argv[0]);
+                    return -1;
+                }
+                FORMAT = f;
+                start += 2;
+            } break;
             default:
                 usage(argv[0]);
                 return -1;
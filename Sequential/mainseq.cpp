@@ -30,23 +30,14 @@ int main(int argc, char *argv[]) {
     // Start the timer
     auto start_time = std::chrono::steady_clock::now();
 
-    // Process each file or directory provided in the command line
-    for (int i = start; i < argc; ++i) {
-        struct stat statbuf;
-        if (stat(argv[i], &statbuf) == -1) {
-            perror("stat");
-            std::fprintf(stderr, "Error: stat %s\n", argv[i]);
-            success = false;
-            continue;
-        }
-
-        // Check if it's a directory or a file
-        if (S_ISDIR(statbuf.st_mode)) { 
-            success &= walkDir(argv[i], comp);
-        } else {
-            success &= doWork(argv[i], statbuf.st_size, comp); 
-        }
+    // Process each file provided in the command line or found in its directories
+    FileWalker walker(start, argv, argc, acceptFile, RECUR, QUITE_MODE);
+    std::string file;
+    long size;
+    while (walker.next(file, size)) {
+        success &= doWork(file.c_str(), size, comp);
     }
+    success &= (walker.errors == 0);
 
     // Stop the timer
     auto end_time = std::chrono::steady_clock::now();
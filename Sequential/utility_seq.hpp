@@ -25,9 +25,10 @@ Note: I modified the function compressFile in order to not compress files that a
 
 
 #include <../miniz/miniz.h>
+#include <../common/filewalker.hpp>
+#include <../common/format.hpp>
 
 
-#define SUFFIX ".zip"
 #define BUF_SIZE (1024 * 1024)
 
 // global variables with their default values ---------------------------------------------------
@@ -35,6 +36,9 @@ static bool comp = true;                        // by default, it compresses
 static bool REMOVE_ORIGIN = false;              // Does it keep the origin file?
 static int  QUITE_MODE = 1;                     // 0 silent, 1 only errors, 2 everything
 static bool RECUR = false;                      // do we have to process the contents of subdirs?
+static int  LEVEL = MZ_DEFAULT_LEVEL;           // compression level (0..10)
+static int  STRATEGY = MZ_DEFAULT_STRATEGY;     // deflate strategy (MZ_DEFAULT_STRATEGY, MZ_FILTERED, MZ_HUFFMAN_ONLY, MZ_RLE, MZ_FIXED)
+static int  FORMAT = 0;                         // 0 zlib stream (.zip), 3 gzip file (.gz, as -f 3 of the parallel versions)
 // ----------------------------------------------------------------------------------------------
 
 // map the file pointed by filepath in memory
@@ -83,6 +87,21 @@ static inline void unmapFile(unsigned char *ptr, size_t size) {
 	}
     }
 }
+// compress in one shot with LEVEL and STRATEGY, the output is a zlib stream (as the one of compress())
+// or raw deflate data if raw is true
+// on input outLen is the size of the output buffer, on output the compressed size
+static inline bool compressLevel(unsigned char *out, unsigned long *outLen, const unsigned char *in, size_t inLen, bool raw = false) {
+    const mz_uint flags = tdefl_create_comp_flags_from_zip_params(LEVEL, raw ? -MZ_DEFAULT_WINDOW_BITS : MZ_DEFAULT_WINDOW_BITS, STRATEGY);
+    const size_t n = tdefl_compress_mem_to_mem(out, *outLen, in, inLen, flags);
+    if (n == 0) return false;
+    *outLen = n;
+    return true;
+}
+// suffix of the files written when compressing
+static inline const char *outSuffix() {
+    return FORMAT == 3 ? GZ_SUFFIX : SUFFIX;
+}
+
 // write size bytes starting from ptr into filename
 static inline bool writeFile(const std::string &filename, unsigned char *ptr, size_t size) {
     FILE *pOutfile = fopen(filename.c_str(), "wb");
@@ -202,29 +221,36 @@ static inline int compressFile(const char fname[], size_t infile_size,
     // input file name
     const std::string infilename(fname);
 
-	// Check if the file already has a .zip suffix
-    if (infilename.size() > 4 && infilename.substr(infilename.size() - 4) == SUFFIX) {
+	// Check if the file already has the suffix of the compressed files
+    const std::string suffix = outSuffix();
+    if (infilename.size() > suffix.size() && infilename.substr(infilename.size() - suffix.size()) == suffix) {
         if (QUITE_MODE >= 1) {
-            std::fprintf(stderr, "File %s already has a .zip suffix -- skipping compression\n", fname);
+            std::fprintf(stderr, "File %s already has a %s suffix -- skipping compression\n", fname, suffix.c_str());
         }
         return 0; // Indicate success without compression
     }
 
 	// define the output file name
-    std::string outfilename = std::string(fname) + SUFFIX;
+    std::string outfilename = std::string(fname) + suffix;
 
     unsigned char *ptr = nullptr;
     if (!mapFile(fname, infile_size, ptr)) return -1;
     // get an estimation of the maximum compression size
     unsigned long cmp_len = compressBound(infile_size);
-    // allocate memory to store compressed data in memory
-    unsigned char *ptrOut = new unsigned char[cmp_len];
-    if (compress(ptrOut, &cmp_len, (const unsigned char *)ptr, infile_size) != Z_OK) {
+    // allocate memory to store compressed data in memory (gzip: with room for the header and the trailer)
+    const size_t gz = (FORMAT == 3);
+    unsigned char *ptrOut = new unsigned char[cmp_len + gz * (GZ_HEADER_SIZE + GZ_TRAILER_SIZE)];
+    if (!compressLevel(ptrOut + gz * GZ_HEADER_SIZE, &cmp_len, (const unsigned char *)ptr, infile_size, gz)) {
 	if (QUITE_MODE>=1) 
 	    std::fprintf(stderr, "Failed to compress file in memory\n");
 	delete [] ptrOut;
 	return -1;
     }
+    if (gz) {
+	std::memcpy(ptrOut, GZ_HEADER, GZ_HEADER_SIZE);
+	gzTrailer(ptrOut + GZ_HEADER_SIZE + cmp_len, mz_crc32(MZ_CRC32_INIT, ptr, infile_size), infile_size);
+	cmp_len += GZ_HEADER_SIZE + GZ_TRAILER_SIZE;
+    }
     // write the compressed data into disk 
     bool success = writeFile(outfilename, ptrOut, cmp_len);
     if (success && removeOrigin) {
@@ -404,59 +430,16 @@ static inline bool doWork(const char fname[], size_t size, const bool comp) {
     return true;
 }
 
-// returns false in case of error
-static inline bool walkDir(const char dname[], const bool comp) {
-    if (chdir(dname) == -1) {
-		if (QUITE_MODE >= 1) {
-			perror("chdir");
-			std::fprintf(stderr, "Error: chdir %s\n", dname);
-		}
-		return false;
-    }
-    DIR *dir;	
-    if ((dir = opendir(".")) == NULL) {
-		if (QUITE_MODE >= 1) {
-			perror("opendir");
-			std::fprintf(stderr, "Error: opendir %s\n", dname);
-		}
-		return false;
-    }
-    struct dirent *file;
-    bool error = false;
-    while((errno = 0, file = readdir(dir)) != NULL) {
-		if (strcmp(file->d_name, ".DS_Store") == 0) {
-			continue; // Skip the .DS_Store file
-		}
-		struct stat statbuf;
-		if (stat(file->d_name, &statbuf) == -1) {
-			if (QUITE_MODE >= 1) {		
-				perror("stat");
-				std::fprintf(stderr, "Error: stat %s\n", file->d_name);
-			}
-			return false;
-		}
-		if (S_ISDIR(statbuf.st_mode)) {
-			if ( !isdot(file->d_name) ) { // check if it is '.' or '..'
-				if (RECUR) { // process the content of subdirs if RECUR is true
-					if (walkDir(file->d_name, comp)) {
-						if (chdir("..") == -1) {
-							perror("chdir");
-							std::fprintf(stderr, "Error: chdir ..\n");
-							error = true;
-						}
-					} else error = true;
-				}	
-			}
-		} else { // it is a file
-			if (!doWork(file->d_name, statbuf.st_size, comp)) error = true;
-		}
-    }
-    if (errno != 0) {
-		if (QUITE_MODE >= 1) perror("readdir");
-		error=true;
+// Function to check a file found by the walk: when decompressing only the files with the SUFFIX suffix are processed
+// (when compressing every file is, compressFile skips the ones that already have it)
+static bool acceptFile(const std::string &filePath, long) {
+    if (!comp && discardIt(filePath.c_str(), false)) {
+        if (QUITE_MODE >= 2) {
+            std::fprintf(stderr, "%s does not have a %s suffix -- ignored\n", filePath.c_str(), SUFFIX);
+        }
+        return false;
     }
-    closedir(dir);
-    return !error;
+    return true;
 }
 
 #endif // _UTILITY_HPP_seq
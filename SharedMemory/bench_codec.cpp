@@ -0,0 +1,104 @@
+/*
+Microbenchmark of the block codec: one-shot compress()/uncompress() of miniz (a new
+deflate/inflate state for every block) against a Codec reused for all the blocks (as the
+R-Workers do). The same buffer is processed with several block sizes.
+
+usage: bench_codec [total size in MB (default 64)] [compression level (default 6)]
+*/
+
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#include <../common/codec.hpp>
+#include <../common/number.hpp>
+
+// pseudo text: random words from a small dictionary, it compresses about as a text file
+static std::vector<unsigned char> makeData(size_t size) {
+    static const char *words[] = {"the ", "parallel ", "block ", "of ", "file ", "compression ", "and ",
+                                  "worker ", "a ", "stream ", "data ", "to ", "miniz ", "in ", "with ", "\n"};
+    std::mt19937 gen(42);
+    std::uniform_int_distribution<int> pick(0, 15);
+    std::vector<unsigned char> data;
+    data.reserve(size + 16);
+    while (data.size() < size) {
+        const char *w = words[pick(gen)];
+        data.insert(data.end(), w, w + std::strlen(w));
+    }
+    data.resize(size);
+    return data;
+}
+
+// seconds spent by f
+template <typename F>
+static double timeIt(F f) {
+    auto start = std::chrono::steady_clock::now();
+    f();
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char *argv[]) {
+    long mb = 64, level = MZ_DEFAULT_LEVEL;
+    if ((argc > 1 && (!isNumber(argv[1], mb) || mb <= 0)) ||
+        (argc > 2 && (!isNumber(argv[2], level) || level < 0 || level > 10))) {
+        std::fprintf(stderr, "use: %s [total size in MB] [compression level 0..10]\n", argv[0]);
+        return -1;
+    }
+
+    const size_t total = mb * 1024 * 1024;
+    const std::vector<unsigned char> data = makeData(total);
+    const size_t blockSizes[] = {4 * 1024, 16 * 1024, 64 * 1024, 256 * 1024, 1024 * 1024, 2 * 1024 * 1024};
+
+    std::printf("%zu MB, level %ld: throughput in MB/s\n", total / (1024 * 1024), level);
+    std::printf("%10s %12s %12s %8s %12s %12s %8s\n", "block", "compress()", "Codec", "gain", "uncompress()", "Codec", "gain");
+
+    Codec codec(level);
+    for (size_t bs : blockSizes) {
+        const size_t nblocks = (total + bs - 1) / bs;
+        std::vector<unsigned char> cmp(nblocks * compressBound(bs));
+        std::vector<unsigned long> cmpLen(nblocks);
+        std::vector<unsigned char> out(bs);
+        bool ok = true;
+
+        auto blockSize = [&](size_t i) { return std::min(bs, total - i * bs); };
+        auto blockCmp = [&](size_t i) { return cmp.data() + i * compressBound(bs); };
+
+        const double tc1 = timeIt([&] {
+            for (size_t i = 0; i < nblocks; ++i) {
+                cmpLen[i] = compressBound(bs);
+                ok &= (compress2(blockCmp(i), &cmpLen[i], data.data() + i * bs, blockSize(i), level) == Z_OK);
+            }
+        });
+        const double tc2 = timeIt([&] {
+            for (size_t i = 0; i < nblocks; ++i) {
+                cmpLen[i] = compressBound(bs);
+                ok &= codec.compress(blockCmp(i), &cmpLen[i], data.data() + i * bs, blockSize(i));
+            }
+        });
+        const double td1 = timeIt([&] {
+            for (size_t i = 0; i < nblocks; ++i) {
+                unsigned long len = bs;
+                ok &= (uncompress(out.data(), &len, blockCmp(i), cmpLen[i]) == Z_OK) && (len == blockSize(i));
+            }
+        });
+        const double td2 = timeIt([&] {
+            for (size_t i = 0; i < nblocks; ++i) {
+                size_t len = bs;
+                ok &= codec.uncompress(out.data(), &len, blockCmp(i), cmpLen[i]) && (len == blockSize(i));
+            }
+        });
+        // the last block has to be the original one
+        ok &= (std::memcmp(out.data(), data.data() + (nblocks - 1) * bs, blockSize(nblocks - 1)) == 0);
+        if (!ok) {
+            std::fprintf(stderr, "Error with blocks of %zu bytes\n", bs);
+            return -1;
+        }
+
+        const double m = (double)total / (1024 * 1024);
+        std::printf("%8zuKB %12.1f %12.1f %7.2fx %12.1f %12.1f %7.2fx\n", bs / 1024,
+                    m / tc1, m / tc2, tc1 / tc2, m / td1, m / td2, td1 / td2);
+    }
+    return 0;
+}
@@ -0,0 +1,142 @@
+/*
+Microbenchmark of the two ways mainff reads an input file (see -i): mapped with mmap (touching every page, then
+munmap) against pread into a buffer that is reused, as the pooled buffers of the L-Workers.
+The files are created once in the directory and read many times, so they are in the page cache: what is measured is
+the cost of the mapping (page faults, page table and TLB shootdowns at munmap) against the copy of pread.
+The same test runs with more and more threads, the threshold suggested for -i is the largest size for which pread
+is faster with the most threads.
+
+usage: bench_read [max n. of threads (default 2 * cores)] [files per size (default 256)] [directory (default /tmp)]
+*/
+
+#include <chrono>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <string>
+
+#include <../common/blocksize.hpp>
+#include <mapping_ff.hpp>
+
+// seconds spent by f
+template <typename F>
+static double timeIt(F f) {
+    auto start = std::chrono::steady_clock::now();
+    f();
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// the sum of one byte per page, so that every page is really read
+static unsigned long touch(const unsigned char *ptr, size_t size) {
+    unsigned long sum = 0;
+    for (size_t i = 0; i < size; i += 4096) sum += ptr[i];
+    return sum + ptr[size - 1];
+}
+
+static bool readMapped(const std::string &fname, unsigned long &sum) {
+    size_t size = 0;
+    unsigned char *ptr = nullptr;
+    if (!mapFile(fname.c_str(), size, ptr)) return false;
+    sum += touch(ptr, size);
+    unmapFile(ptr, size);
+    return true;
+}
+
+static bool readCopied(const std::string &fname, size_t size, unsigned char *buf, unsigned long &sum) {
+    int fd = open(fname.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+    size_t done = 0;
+    while (done < size) {
+        ssize_t n = pread(fd, buf + done, size - done, done);
+        if (n <= 0) break;
+        done += n;
+    }
+    close(fd);
+    if (done != size) return false;
+    sum += touch(buf, size);
+    return true;
+}
+
+int main(int argc, char *argv[]) {
+    long maxThreads = 2 * std::thread::hardware_concurrency(), nfiles = 256;
+    if ((argc > 1 && (!isNumber(argv[1], maxThreads) || maxThreads <= 0)) ||
+        (argc > 2 && (!isNumber(argv[2], nfiles) || nfiles <= 0))) {
+        std::fprintf(stderr, "use: %s [max n. of threads] [files per size] [directory]\n", argv[0]);
+        return -1;
+    }
+    maxThreads = std::max(maxThreads, 1L);
+    const std::string dir = std::string(argc > 3 ? argv[3] : "/tmp") + "/bench_read." + std::to_string(getpid());
+    if (mkdir(dir.c_str(), 0700) != 0) {
+        perror("mkdir");
+        return -1;
+    }
+
+    const size_t sizes[] = {4 * 1024, 16 * 1024, 64 * 1024, 128 * 1024, 256 * 1024, 1024 * 1024};
+    std::vector<long> threads;
+    for (long n = 1; n < maxThreads; n *= 2) threads.push_back(n);
+    threads.push_back(maxThreads);
+
+    std::printf("%ld files per size, %d rounds: throughput in MB/s\n", nfiles, 8);
+    std::printf("%10s %8s %12s %12s %8s\n", "size", "threads", "mmap", "pread", "gain");
+
+    bool ok = true;
+    size_t suggested = 0;
+    for (size_t size : sizes) {
+        std::vector<std::string> files;
+        std::vector<unsigned char> data(size);
+        for (size_t i = 0; i < size; ++i) data[i] = (unsigned char)(i * 31 + size);
+        for (long i = 0; i < nfiles && ok; ++i) {
+            files.push_back(dir + "/" + std::to_string(size) + "_" + std::to_string(i));
+            FILE *f = std::fopen(files.back().c_str(), "wb");
+            ok = f && std::fwrite(data.data(), 1, size, f) == size;
+            if (f) std::fclose(f);
+        }
+        if (!ok) {
+            std::fprintf(stderr, "Error writing the files of %zu bytes in %s\n", size, dir.c_str());
+            break;
+        }
+
+        double gain = 0;
+        for (long nt : threads) {
+            std::vector<unsigned long> sums(nt, 0);
+            std::atomic<bool> good(true);
+            // every thread reads all the files 8 times, starting from a different one
+            auto run = [&](bool mapped) {
+                return timeIt([&] {
+                    std::vector<std::thread> pool;
+                    for (long t = 0; t < nt; ++t)
+                        pool.emplace_back([&, t] {
+                            std::vector<unsigned char> buf(mapped ? 0 : size);
+                            for (long r = 0; r < 8 * nfiles; ++r) {
+                                const std::string &fname = files[(r + t) % nfiles];
+                                if (!(mapped ? readMapped(fname, sums[t]) : readCopied(fname, size, buf.data(), sums[t]))) good = false;
+                            }
+                        });
+                    for (auto &th : pool) th.join();
+                });
+            };
+            run(false); // warm up the page cache
+            const double tm = run(true), tr = run(false);
+            if (!good) {
+                std::fprintf(stderr, "Error reading the files of %zu bytes\n", size);
+                ok = false;
+                break;
+            }
+            const double m = (double)size * nfiles * 8 * nt / (1024 * 1024);
+            gain = tm / tr;
+            std::printf("%8zuKB %8ld %12.1f %12.1f %7.2fx\n", size / 1024, nt, m / tm, m / tr, gain);
+        }
+        for (auto &f : files) unlink(f.c_str());
+        if (!ok) break;
+        if (gain > 1 && size <= MIN_BLOCK_SIZE) suggested = size; // pread faster with the most threads
+    }
+    rmdir(dir.c_str());
+    if (!ok) return -1;
+
+    std::printf("suggested threshold with %ld threads: -i %zu\n", maxThreads, suggested / 1024);
+    return 0;
+}
@@ -15,7 +15,10 @@ this file was built on top of the cmdline.hpp file from the ffc folder
 // Set some global variables, a few others are in utility_ff.hpp 
 static long lworkers = 2;  // the number of Left Workers
 static long rworkers = ff_numCores() - 3;  // the number of Right Workers
+static long wworkers = 1;  // the number of Writers (all the blocks of a file go to the same one)
 static bool BLOCKING = true;    // concurrency control, default is blocking
+static long wblocks = 0;        // reorder window of the Writer in blocks per file (0 means 2 * rworkers)
+static bool DYNAMIC = true;     // files claimed by the L-Workers at run time, or statically partitioned
 
 
 static inline void usage(const char *argv0) {
@@ -24,21 +27,36 @@ static inline void usage(const char *argv0) {
     std::printf("\nOptions:\n");
     std::printf(" -l set the n. of Left Workers (default lworkers=%ld)\n", lworkers);
     std::printf(" -r set the n. of Right Workers (default rworkers=%ld)\n", rworkers);
-    std::printf(" -t set the \"BIG file\" low threshold (in Mbyte -- min. and default %ld Mbyte)\n", BIGFILE_LOW_THRESHOLD /(1024 * 1024));
+    std::printf(" -W set the n. of Writers, the files are spread among them by name (default wworkers=%ld)\n", wworkers);
+    std::printf(" -t set the \"BIG file\" low threshold, i.e. the block size (in Mbyte -- min. and default %ld Mbyte, or in Kbyte with a K suffix -- min. %dK)\n", BIGFILE_LOW_THRESHOLD /(1024 * 1024), MIN_BLOCK_SIZE / 1024);
+    std::printf("    -t auto chooses it from the input size, the n. of workers and the memory, -t file also adapts it to each file\n");
     std::printf(" -R 0 does not recur, 1 will process the content of all subdirectories (default R=%d)\n", RECUR ? 1 : 0);
     std::printf(" -C compress: 0 preserves, 1 removes the original file (default C=%d)\n", REMOVE_ORIGIN ? 1 : 0);
     std::printf(" -D decompress: 0 preserves, 1 removes the original file (default D=%d)\n", REMOVE_ORIGIN ? 1 : 0);
+    std::printf(" -V 1 test mode: decompresses and checks the compressed files without writing anything (default V=%d)\n", VERIFY ? 1 : 0);
     std::printf(" -q 0 silent mode, 1 prints only error messages to stderr, 2 verbose (default q=%d)\n", QUITE_MODE ? 1 : 0);
+    std::printf(" -L compression level, from 0 (no compression) to 10 (best) (default L=%d)\n", LEVEL);
+    std::printf(" -S deflate strategy: 0 default, 1 filtered, 2 huffman only, 3 rle, 4 fixed (default S=%d)\n", STRATEGY);
+    std::printf(" -P 1 stores the incompressible blocks as they are, 0 compresses all the blocks (default P=%d)\n", PROBE ? 1 : 0);
+    std::printf(" -d 1 chains the blocks of a \"BIG file\": each one uses the end of the previous one as dictionary (format 2 or 3, default d=%d)\n", CHAIN ? 1 : 0);
+    std::printf(" -f format of the compressed files: 1 header first, 2 trailer index, 3 gzip (.gz, for gzip -d) (default f=%d)\n", FORMAT);
+    std::printf(" -a name: compresses all the files as the members of the ZIP archive name (read it with unzip)\n");
+    std::printf(" -B 1 packs up to %d \"small files\" (about a block of data) in a task, 0 one task per file (default B=%d)\n", BATCH_FILES, BATCH ? 1 : 0);
+    std::printf(" -i files up to this size in Kbyte are read into pooled buffers instead of mapped, max %d, 0 maps all (default i=%zu)\n", MIN_BLOCK_SIZE / 1024, READ_THRESHOLD / 1024);
+    std::printf(" -p n. of blocks of a file read ahead of the R-Workers (madvise), 0 no read-ahead hints (default p=%ld)\n", PREFETCH);
+    std::printf(" -M memory budget of the blocks in flight, in Mbyte: the L-Workers wait when it is used up (default no limit)\n");
     std::printf(" -b 1 blocking, 0 non-blocking concurrency control (default b=%d)\n", BLOCKING ? 1 : 0);
+    std::printf(" -s 1 the L-Workers claim the files at run time, 0 static partitioning of the files (default s=%d)\n", DYNAMIC ? 1 : 0);
+    std::printf(" -w set the reorder window of the Writer, in blocks per \"BIG file\" (default 2 * rworkers)\n");
     std::printf("--------------------\n");
 }
 
 int parseCommandLine(int argc, char *argv[]) {
     extern char *optarg;
-    const std::string optstr="l:r:t:R:C:D:q:b:";
+    const std::string optstr="l:r:W:t:R:C:D:V:q:b:w:f:s:L:S:P:d:a:B:M:p:i:";
     
     long opt, start = 1;
-    bool cpresent = false, dpresent = false; // flags for the presence of -C and -D
+    bool cpresent = false, dpresent = false, vpresent = false; // flags for the presence of -C, -D and -V
 
     while((opt = getopt(argc, argv, optstr.c_str())) != -1) {
         switch(opt) {
@@ -72,16 +90,28 @@ int parseCommandLine(int argc, char *argv[]) {
                 rworkers = r;
                 start += 2;      
             } break;
+            case 'W': {
+                long w = 0;
+                if (!isNumber(optarg, w)) {
+                    std::fprintf(stderr, "Error: wrong '-W' option\n");
+                    usage(argv[0]);
+                    return -1;
+                }
+                // if w is negative or zero, it will be set to default value
+                if (w <= 0) {
+                    std::fprintf(stderr, "Warning: the number of Writers must be positive, set to default value %ld\n", wworkers);
+                    w = wworkers;
+                }
+                wworkers = w;
+                start += 2;
+            } break;
             case 't': {
-                long t = 0;
-                if (!isNumber(optarg, t)) {
+                if (!parseBlockSize(optarg)) {
                     std::fprintf(stderr, "Error: wrong '-t' option\n");
                     usage(argv[0]);
                     return -1;
                 }
-                t = std::max(2l, t); // min threshold accepted is 2MB (2l = 2 long)
-                BIGFILE_LOW_THRESHOLD = t * (1024 * 1024); // convert to bytes
-                if (t > 100) { // just to set a limit
+                if (BIGFILE_LOW_THRESHOLD > MAX_BLOCK_SIZE) { // just to set a limit
                     std::fprintf(stderr, "Error: \"BIG file\" low threshold too high, set it lower than 100 MB\n"); 
                     return -1;
                 } 
@@ -120,6 +150,20 @@ int parseCommandLine(int argc, char *argv[]) {
                 comp = false; // comp = true in utility_ff.hpp, so by default it compresses 
                 start += 2;
             } break;
+            case 'V': {
+                long v = 0;
+                if (!isNumber(optarg, v)) {
+                    std::fprintf(stderr, "Error: wrong '-V' option\n");
+                    usage(argv[0]);
+                    return -1;
+                }
+                if (v == 1) {
+                    vpresent = true;
+                    VERIFY = true;
+                    comp = false; // the compressed files are decompressed, but nothing is written
+                }
+                start += 2;
+            } break;
             case 'q': {
                 long q = 0;
                 if (!isNumber(optarg, q)) {
@@ -130,6 +174,101 @@ int parseCommandLine(int argc, char *argv[]) {
                 QUITE_MODE = q;
                 start += 2; 
             } break;
+            case 'L': {
+                long l = 0;
+                if (!isNumber(optarg, l) || l < 0 || l > 10) {
+                    std::fprintf(stderr, "Error: wrong '-L' option, the level goes from 0 to 10\n");
+                    usage(argv[0]);
+                    return -1;
+                }
+                LEVEL = l;
+                start += 2;
+            } break;
+            case 'S': {
+                long st = 0;
+                if (!isNumber(optarg, st) || st < MZ_DEFAULT_STRATEGY || st > MZ_FIXED) {
+                    std::fprintf(stderr, "Error: wrong '-S' option, the strategy goes from 0 to 4\n");
+                    usage(argv[0]);
+                    return -1;
+                }
+                STRATEGY = st;
+                start += 2;
+            } break;
+            case 'P': {
+                long pr = 0;
+                if (!isNumber(optarg, pr)) {
+                    std::fprintf(stderr, "Error: wrong '-P' option\n");
+                    usage(argv[0]);
+                    return -1;
+                }
+                if (pr == 0) PROBE = false;
+                start += 2;
+            } break;
+            case 'd': {
+                long d = 0;
+                if (!isNumber(optarg, d)) {
+                    std::fprintf(stderr, "Error: wrong '-d' option\n");
+                    usage(argv[0]);
+                    return -1;
+                }
+                if (d == 1) CHAIN = true;
+                start += 2;
+            } break;
+            case 'f': {
+                long f = 0;
+                if (!isNumber(optarg, f) || f < 1 || f > 3) {
+                    std::fprintf(stderr, "Error: wrong '-f' option, the format can be 1, 2 or 3\n");
+                    usage(argv[0]);
+                    return -1;
+                }
+                FORMAT = f;
+                start += 2;
+            } break;
+            case 'a': {
+                ARCHIVE = optarg;
+                start += 2;
+            } break;
+            case 'B': {
+                long b = 0;
+                if (!isNumber(optarg, b)) {
+                    std::fprintf(stderr, "Error: wrong '-B' option\n");
+                    usage(argv[0]);
+                    return -1;
+                }
+                if (b == 0) BATCH = false;
+                start += 2;
+            } break;
+            case 'M': {
+                long m = 0;
+                if (!isNumber(optarg, m) || m <= 0) {
+                    std::fprintf(stderr, "Error: wrong '-M' option, the budget is a positive number of Mbyte\n");
+                    usage(argv[0]);
+                    return -1;
+                }
+                MEMORY_BUDGET = (size_t)m * 1024 * 1024;
+                start += 2;
+            } break;
+            case 'i': {
+                long kb = 0;
+                // up to the smallest block size: a file that is read is always a "small file" when compressing
+                if (!isNumber(optarg, kb) || kb < 0 || kb > MIN_BLOCK_SIZE / 1024) {
+                    std::fprintf(stderr, "Error: wrong '-i' option, the size goes from 0 to %d Kbyte\n", MIN_BLOCK_SIZE / 1024);
+                    usage(argv[0]);
+                    return -1;
+                }
+                READ_THRESHOLD = (size_t)kb * 1024;
+                start += 2;
+            } break;
+            case 'p': {
+                long pf = 0;
+                if (!isNumber(optarg, pf) || pf < 0) {
+                    std::fprintf(stderr, "Error: wrong '-p' option\n");
+                    usage(argv[0]);
+                    return -1;
+                }
+                PREFETCH = pf;
+                start += 2;
+            } break;
             case 'b': {
                 long b = 0;
                 if (!isNumber(optarg, b)) {
@@ -140,6 +279,31 @@ int parseCommandLine(int argc, char *argv[]) {
                 if (b == 0) BLOCKING = false;
                 start += 2;
             } break;
+            case 's': {
+                long sch = 0;
+                if (!isNumber(optarg, sch)) {
+                    std::fprintf(stderr, "Error: wrong '-s' option\n");
+                    usage(argv[0]);
+                    return -1;
+                }
+                if (sch == 0) DYNAMIC = false;
+                start += 2;
+            } break;
+            case 'w': {
+                long w = 0;
+                if (!isNumber(optarg, w)) {
+                    std::fprintf(stderr, "Error: wrong '-w' option\n");
+                    usage(argv[0]);
+                    return -1;
+                }
+                // if w is negative or zero, the default value is used
+                if (w <= 0) {
+                    std::fprintf(stderr, "Warning: the reorder window must be positive, set to default value (2 * rworkers)\n");
+                    w = 0;
+                }
+                wblocks = w;
+                start += 2;
+            } break;
             default:
                 usage(argv[0]);
                 return -1;
@@ -150,6 +314,27 @@ int parseCommandLine(int argc, char *argv[]) {
 		usage(argv[0]);
 		return -1;
     }
+    if (vpresent && (cpresent || dpresent)) {
+		std::fprintf(stderr, "Error: -V cannot be used with -C or -D!\n");
+		usage(argv[0]);
+		return -1;
+    }
+    if (ARCHIVE && (dpresent || vpresent)) {
+		std::fprintf(stderr, "Error: -a only compresses (extract the archive with unzip)!\n");
+		usage(argv[0]);
+		return -1;
+    }
+    if (ARCHIVE && wworkers > 1) {
+		std::fprintf(stderr, "Error: -a writes a single archive, it needs one Writer (-W 1)!\n");
+		usage(argv[0]);
+		return -1;
+    }
+    if (ARCHIVE) FORMAT = 3; // the blocks of a member are appended as in a gzip file
+    if (CHAIN && FORMAT == 1) {
+		std::fprintf(stderr, "Error: -d 1 needs the format 2 or 3 (the blocks are flagged in the index or form a single stream)!\n");
+		usage(argv[0]);
+		return -1;
+    }
     if ((argc - start) <= 0) {
 		std::fprintf(stderr, "Error: at least one file or directory should be provided!\n");
 		usage(argv[0]);
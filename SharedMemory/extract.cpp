@@ -0,0 +1,27 @@
+/*
+Extract a range of the original data of a file compressed by mainff or mainmpi (format 1 or 2) without decompressing
+the whole file: only the blocks that overlap the range are decompressed, in parallel (see extract_ff.hpp).
+The bytes are written to the standard output.
+
+usage: extract file offset length [n. of workers (default: all the cores)]
+*/
+
+#include <extract_ff.hpp>
+
+int main(int argc, char *argv[]) {
+    long offset = 0, length = 0, nw = ff::ff_numCores();
+    if (argc < 4 || !isNumber(argv[2], offset) || offset < 0 || !isNumber(argv[3], length) || length < 0 ||
+        (argc > 4 && (!isNumber(argv[4], nw) || nw <= 0))) {
+        std::fprintf(stderr, "use: %s file offset length [n. of workers]\n", argv[0]);
+        return -1;
+    }
+
+    std::vector<unsigned char> data;
+    if (!extractRange(argv[1], offset, length, data, nw)) return -1;
+
+    if (std::fwrite(data.data(), 1, data.size(), stdout) != data.size()) {
+        perror("fwrite");
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,105 @@
+#if !defined _EXTRACT_HPP_ff
+#define _EXTRACT_HPP_ff
+
+/*
+Random access to the files compressed by mainff and mainmpi (format 1 and 2): extractRange decompresses only the
+blocks that overlap a range of the original data, in parallel with a FastFlow ParallelFor.
+
+The blocks that are entirely in the range are inflated directly at their place in the output, only the two blocks
+at the ends of the range go through a buffer of the worker.
+The blocks of a chained file (-d 1) need the end of the previous one, so they cannot be decompressed at random:
+they are inflated in order from the first block up to the last one of the range.
+*/
+
+#include <atomic>
+#include <vector>
+
+#include <ff/ff.hpp>
+#include <ff/parallel_for.hpp>
+
+#include <../common/codec.hpp>
+#include <../common/number.hpp>
+#include <mapping_ff.hpp>
+
+
+// extract the bytes [offset, offset + length) of the original data of the compressed file fname into out
+// (the range is clipped to the size of the original data), using up to nw workers
+// it returns false if the file cannot be read or if a block of the range is corrupted
+static bool extractRange(const char *fname, size_t offset, size_t length, std::vector<unsigned char> &out, long nw = ff::ff_numCores()) {
+    out.clear();
+    size_t size = 0;
+    unsigned char *ptr = nullptr;
+    if (!mapFile(fname, size, ptr)) return false;
+
+    std::vector<BlockIndex> index;
+    if (!readIndex(ptr, size, index)) {
+        if (QUITE_MODE >= 1) std::fprintf(stderr, "%s has no block index (not written by mainff or mainmpi?)\n", fname);
+        unmapFile(ptr, size);
+        return false;
+    }
+
+    // offset of each block in the original data, the last entry is the original size
+    std::vector<size_t> start(index.size() + 1, 0);
+    for (size_t i = 0; i < index.size(); ++i) start[i + 1] = start[i] + index[i].size;
+    if (offset >= start.back() || length == 0) { // empty range
+        unmapFile(ptr, size);
+        return true;
+    }
+    length = std::min(length, start.back() - offset);
+    const size_t end = offset + length;
+    out.resize(length);
+
+    // blocks that overlap the range: from first to last
+    const size_t first = std::upper_bound(start.begin(), start.end(), offset) - start.begin() - 1;
+    const size_t last  = std::lower_bound(start.begin(), start.end(), end) - start.begin() - 1;
+
+    // copy the part of block i (decompressed at data) that is in the range
+    auto copyRange = [&](size_t i, const unsigned char *data) {
+        const size_t from = std::max(start[i], offset), to = std::min(start[i + 1], end);
+        std::memcpy(out.data() + (from - offset), data + (from - start[i]), to - from);
+    };
+
+    std::atomic<bool> ok(true);
+    if (index[0].flags & BLOCK_DICT) {
+        // chained file: buf holds the dictionary (the end of the previous block) followed by the block
+        Codec codec;
+        std::vector<unsigned char> buf;
+        size_t dict = 0;
+        for (size_t i = 0; i <= last && ok; ++i) {
+            buf.resize(dict + index[i].size);
+            if (!decodeBlock(codec, index[i], ptr + index[i].offset, buf.data() + dict, dict)) {
+                ok = false;
+                break;
+            }
+            if (i >= first) copyRange(i, buf.data() + dict);
+            const size_t next = dictLen(start[i + 1]);
+            std::memmove(buf.data(), buf.data() + buf.size() - next, next);
+            dict = next;
+        }
+    } else {
+        nw = std::max(1L, std::min(nw, (long)(last - first + 1)));
+        std::vector<Codec> codecs(nw);                          // one inflate state per worker
+        std::vector<std::vector<unsigned char>> buffers(nw);    // blocks at the ends of the range
+        ff::ParallelFor pf(nw);
+        pf.parallel_for_thid(first, last + 1, 1, 1, [&](const long i, const int thid) {
+            const bool whole = (start[i] >= offset && start[i + 1] <= end);
+            if (whole) {
+                if (!decodeBlock(codecs[thid], index[i], ptr + index[i].offset, out.data() + (start[i] - offset))) ok = false;
+                return;
+            }
+            std::vector<unsigned char> &buf = buffers[thid];
+            buf.resize(index[i].size);
+            if (decodeBlock(codecs[thid], index[i], ptr + index[i].offset, buf.data())) copyRange(i, buf.data());
+            else ok = false;
+        }, nw);
+    }
+    unmapFile(ptr, size);
+
+    if (!ok) {
+        if (QUITE_MODE >= 1) std::fprintf(stderr, "%s: corrupted block in the range [%zu, %zu)\n", fname, offset, end);
+        out.clear();
+    }
+    return ok;
+}
+
+#endif // _EXTRACT_HPP_ff
@@ -10,11 +10,16 @@ Parallel schema:
     L-Worker --|     |               |                   
                |     |--> R-Worker --|    
 
-Files are distinguished between "small files" and "big files" depending on BIGFILE_LOW_THRESHOLD.
-
-Header: 
-- Single block file: [1, size, cmp_size] --> 24 bytes 
-- Big file splitted in N blocks: [N, size1, cmp_size1, ..., sizeN, cmp_sizeN] --> 8 + N * 16 bytes
+The L-Workers read the files and split the "BIG files" (larger than BIGFILE_LOW_THRESHOLD, the block size, see -t)
+into blocks, the R-Workers compress or decompress the blocks and the Writer writes the files that have to be written
+in block order. The formats are described in common/format.hpp, and the mechanisms next to their classes:
+- format 2 (default): the R-Workers write the blocks of a "BIG file" themselves (OutBlocks)
+- format 1 (-f 1) and 3 (-f 3, gzip): the Writer appends the blocks in order (Writer, ReorderWindow)
+- archive mode (-a): the Writer writes the files as the members of a ZIP archive (Writer)
+- decompression: the R-Workers inflate the blocks of a "BIG file" in the mapped output file (OutMap)
+- test mode (-V 1): the R-Workers decompress and check the blocks, nothing is written
+- memory of the blocks in flight (-M): MemoryBudget; input files read with pread (-i) or with read-ahead hints (-p):
+  utility_ff.hpp
 
 
 Note: This file was built on top of the primes_a2a.cpp file from the exercises/spmcode7 folder, and the files in the ffc folder.
@@ -23,16 +28,107 @@ Note: This file was built on top of the primes_a2a.cpp file from the exercises/s
 #include <cstdio>
 #include <iostream>
 #include <string>
+#include <map>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
 
 #include <cmdline_ff.hpp>
 
 #include <ff/ff.hpp>
 #include <ff/pipeline.hpp>
 #include <ff/all2all.hpp>
+#include <ff/farm.hpp>
 
 using namespace ff;
 
 
+// --------------------------------------------------------------------------------------------------- buffer pool -------------
+// Free list of fixed-size output buffers of an R-Worker. The buffers are pre-faulted when they are created and
+// given back by whoever consumes the block (the R-Worker itself or the Writer), so that in steady state
+// no memory is allocated
+struct BufferPool {
+    BufferPool(size_t bufSize) : bufSize(bufSize) {}
+
+    ~BufferPool() {
+        for (auto buf : freeList) delete [] buf;
+    }
+
+    unsigned char *get() {
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            if (!freeList.empty()) {
+                unsigned char *buf = freeList.back();
+                freeList.pop_back();
+                return buf;
+            }
+            ++allocated;
+        }
+        unsigned char *buf = new unsigned char[bufSize];
+        std::memset(buf, 0, bufSize); // touch all the pages now, not in the middle of (de)compression
+        return buf;
+    }
+
+    void put(unsigned char *buf) {
+        std::lock_guard<std::mutex> lock(mtx);
+        freeList.push_back(buf);
+    }
+
+    const size_t bufSize;
+    size_t allocated = 0;                   // #buffers created so far
+    std::mutex mtx;
+    std::vector<unsigned char*> freeList;
+};
+
+
+// --------------------------------------------------------------------------------------------------- input files -------------
+// The files up to READ_THRESHOLD bytes (the size decides, when they are opened and when they are released) are read
+// with pread into the buffers of readPool, the larger ones are mapped. A small file costs a few syscalls and no
+// mapping: no munmap and no TLB shootdown of all the threads of the process for every file
+static BufferPool *readPool = nullptr;
+
+static inline bool isRead(size_t size) {
+    return readPool && size <= READ_THRESHOLD;
+}
+
+// get the content of the input file fname, of the given size
+static inline bool openInput(const char fname[], size_t size, unsigned char *&ptr) {
+    if (!isRead(size)) return mapFile(fname, size, ptr);
+
+    int fd = open(fname, O_RDONLY);
+    if (fd < 0) {
+        if (QUITE_MODE >= 1) {
+            perror("openInput open");
+            std::fprintf(stderr, "Failed opening file %s\n", fname);
+        }
+        return false;
+    }
+    ptr = readPool->get();
+    size_t done = 0;
+    while (done < size) {
+        ssize_t n = pread(fd, ptr + done, size - done, done);
+        if (n <= 0) { // error, or the file is shorter than expected
+            if (QUITE_MODE >= 1) {
+                perror("pread");
+                std::fprintf(stderr, "Failed reading file %s\n", fname);
+            }
+            close(fd);
+            readPool->put(ptr);
+            return false;
+        }
+        done += n;
+    }
+    close(fd);
+    return true;
+}
+
+// release an input file got with openInput
+static inline void closeInput(unsigned char *ptr, size_t size) {
+    if (isRead(size)) readPool->put(ptr);
+    else unmapFile(ptr, size);
+}
+
+
 // --------------------------------------------------------------------------------------------------- task --------------------
 struct Task_t {
     Task_t(unsigned char *ptr, size_t size, const std::string &name):
@@ -45,12 +141,333 @@ struct Task_t {
     size_t cmp_size = 0;                // output size
     size_t blockid = 1;                 // block identifier (for "BIG files")
     size_t nblocks = 1;                 // #blocks in which a "BIG file" is split
+    unsigned char *mapPtr = nullptr;    // whole mapped input file (decompression, chained gzip: unmapped when the file is done)
+    size_t mapSize = 0;                 // size of the whole mapped input file
+    BufferPool *pool = nullptr;         // pool owning ptrOut (nullptr: ptrOut allocated with new[])
+    struct OutMap *outMap = nullptr;    // decompression of a "BIG file" straight into the mapped output file
+    struct OutBlocks *outBlocks = nullptr; // compression of a "BIG file" in format 2, written by the R-Workers
+    size_t flags = 0;                   // BLOCK_STORED: the block is stored as it is (ptrOut is not used), BLOCK_CRC
+    size_t crc = 0;                     // CRC32 of the original block (if BLOCK_CRC)
+    size_t dict = 0;                    // chained block: #bytes just before ptr (compression) or ptrOut (decompression) used as dictionary
+    struct CheckFile *check = nullptr;  // test mode: the file the block belongs to
+    Task_t *next = nullptr;             // batch of "small files": the next file of the batch
+    size_t credits = 0;                 // bytes of the memory budget (-M) held by the block, given back with the task
+};
+
+// the data to write for a compressed block
+static inline const unsigned char *blockData(const Task_t *t) {
+    return (t->flags & BLOCK_STORED) ? t->ptr : t->ptrOut;
+}
+
+
+// --------------------------------------------------------------------------------------------------- output blocks -----------
+// Output file of a "BIG file" compressed in format 2: every R-Worker reserves room at the tail of the file
+// and pwrites its block there (in completion order), the last one writes the block index and the trailer.
+// The Writer is not involved. Every block carries the CRC32 of its original data, checked when it is decompressed.
+// With -d 1 the blocks are chained: each one is compressed with the last 32 KB of the previous one as preset
+// dictionary, read from the mapped input (kept mapped until close), so they still compress in parallel
+struct OutBlocks {
+    OutBlocks(const std::string &filename, const std::string &outfile, int fd, size_t nblocks):
+        filename(filename), outfile(outfile), fd(fd), index(nblocks), remaining(nblocks) {}
+
+    // write a compressed block in the first free position of the file
+    bool writeBlock(const Task_t *t) {
+        const size_t offset = tail.fetch_add(t->cmp_size);
+        if (pwrite(fd, blockData(t), t->cmp_size, offset) != (ssize_t)t->cmp_size) {
+            if (QUITE_MODE >= 1) perror("pwrite");
+            return false;
+        }
+        index[t->blockid - 1] = {t->size, t->cmp_size, offset, t->flags, t->crc}; // each entry is written by one R-Worker only
+        return true;
+    }
+
+    // called by the R-Worker that has completed a block, returns true for the last block
+    bool blockDone(bool blockOk) {
+        if (!blockOk) ok = false;
+        return remaining.fetch_sub(1) == 1;
+    }
+
+    void close() {
+        if (ok && !writeIndex(fd, tail, index)) ok = false;
+        if (::close(fd) != 0) ok = false;
+        if (inPtr) unmapFile(inPtr, inSize);
+        if (!ok) {
+            unlink(outfile.c_str()); // do not leave a corrupted file around
+        } else if (REMOVE_ORIGIN) {
+            unlink(filename.c_str());
+        }
+    }
+
+    const std::string filename;         // file to compress
+    const std::string outfile;          // compressed file
+    const int fd;
+    std::vector<BlockIndex> index;
+    std::atomic<size_t> tail{0};        // first free byte of the output file
+    std::atomic<size_t> remaining;      // #blocks not written yet
+    std::atomic<bool> ok{true};
+    unsigned char *inPtr = nullptr;     // chained blocks: the whole mapped input, unmapped here and not block by block
+    size_t inSize = 0;
+};
+
+
+// --------------------------------------------------------------------------------------------------- output map --------------
+// Output file of a "BIG file" being decompressed in place by the R-Workers: the file is created with its final size
+// (the index gives all the original sizes) and mapped, every R-Worker inflates its block at its offset, and the last
+// one that completes a block releases the mappings and closes the job. The Writer is used only if the output file
+// cannot be mapped. All the blocks of a chained file go to the same R-Worker (chosen by the file name), that inflates
+// them in order after the end of the previous one, so different files still go in parallel
+struct OutMap {
+    OutMap(const std::string &filename, const std::string &outfile, size_t nblocks):
+        filename(filename), outfile(outfile), remaining(nblocks) {}
+
+    // called by the R-Worker that has decompressed a block, returns true for the last block
+    bool blockDone(bool blockOk) {
+        if (!blockOk) ok = false;
+        return remaining.fetch_sub(1) == 1;
+    }
+
+    void close() {
+        unmapFile(outPtr, outSize);
+        closeInput(inPtr, inSize);
+        if (!ok) {
+            unlink(outfile.c_str()); // do not leave a corrupted file around
+        } else if (REMOVE_ORIGIN) {
+            unlink(filename.c_str());
+        }
+    }
+
+    const std::string filename;         // compressed file
+    const std::string outfile;          // decompressed file
+    unsigned char *outPtr = nullptr;    // mapped output file
+    size_t outSize = 0;
+    unsigned char *inPtr = nullptr;     // mapped input file
+    size_t inSize = 0;
+    std::atomic<size_t> remaining;      // #blocks not decompressed yet
+    std::atomic<bool> ok{true};
+};
+
+
+// --------------------------------------------------------------------------------------------------- check file --------------
+// Compressed file being checked by the R-Workers (test mode): the last R-Worker that checks a block of
+// the file releases the mapping and reports the result
+static std::atomic<size_t> checkedFiles{0};     // #files checked in test mode
+static std::atomic<size_t> corruptedFiles{0};   // #files with some corrupted blocks
+
+struct CheckFile {
+    CheckFile(const std::string &filename, unsigned char *ptr, size_t size, size_t nblocks):
+        filename(filename), ptr(ptr), size(size), remaining(nblocks) {}
+
+    // called by the R-Worker that has checked a block, returns true for the last block
+    bool blockDone(bool blockOk) {
+        if (!blockOk) ok = false;
+        return remaining.fetch_sub(1) == 1;
+    }
+
+    void close() {
+        closeInput(ptr, size);
+        ++checkedFiles;
+        if (!ok) {
+            ++corruptedFiles;
+            if (QUITE_MODE >= 1) std::fprintf(stderr, "%s: corrupted\n", filename.c_str());
+        } else if (QUITE_MODE >= 2) {
+            std::fprintf(stderr, "%s: OK\n", filename.c_str());
+        }
+    }
+
+    const std::string filename;         // compressed file
+    unsigned char *ptr;                 // mapped compressed file
+    const size_t size;
+    std::atomic<size_t> remaining;      // #blocks not checked yet
+    std::atomic<bool> ok{true};
+};
+
+
+// --------------------------------------------------------------------------------------------------- memory budget -----------
+// Credits for the memory of the blocks in flight (-M): an L-Worker takes the credits of a block (its input and its
+// output buffer) before mapping or sending it, and they come back when the task of the block is given back, that is
+// once the R-Worker or the Writer has written it. A block larger than the whole budget goes through alone
+struct MemoryBudget {
+    // take n bytes if they are available, without waiting
+    bool tryAcquire(size_t n) {
+        std::lock_guard<std::mutex> lock(mtx);
+        if (used > 0 && used + n > limit) return false;
+        take(n);
+        return true;
+    }
+
+    // take n bytes only if a block of `room` bytes still fits next to them, without waiting (the data kept by
+    // the Writer must never stop the blocks it is waiting for)
+    bool tryAcquireLeaving(size_t n, size_t room) {
+        std::lock_guard<std::mutex> lock(mtx);
+        if (used + n + room > limit) return false;
+        take(n);
+        return true;
+    }
+
+    // take n bytes, waiting for the other blocks to give them back
+    void acquire(size_t n) {
+        std::unique_lock<std::mutex> lock(mtx);
+        cv.wait(lock, [&] { return used == 0 || used + n <= limit; });
+        take(n);
+    }
+
+    void release(size_t n) {
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            used -= n;
+        }
+        cv.notify_all();
+    }
+
+    void take(size_t n) {
+        used += n;
+        peak = std::max(peak, used);
+    }
+
+    size_t limit = 0;                   // 0: no budget, the credits are not used at all
+    size_t used = 0;
+    size_t peak = 0;                    // most bytes in flight at the same time
+    std::mutex mtx;
+    std::condition_variable cv;
+};
+
+static MemoryBudget budget;
+
+// bytes of the budget taken by a block: input and output (compressBound for compression, original size for decompression)
+static inline size_t blockCost(size_t size, size_t outSize) {
+    return size + (comp ? compressBound(size) : outSize);
+}
+
+
+// --------------------------------------------------------------------------------------------------- task pool ---------------
+// Recycles the memory of the Task_t objects: the L-Workers get them, the R-Workers or the Writer give them back
+struct TaskPool {
+    ~TaskPool() {
+        for (auto slot : freeList) ::operator delete(slot);
+    }
+
+    Task_t *get(unsigned char *ptr, size_t size, const std::string &name) {
+        void *slot = nullptr;
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            if (!freeList.empty()) {
+                slot = freeList.back();
+                freeList.pop_back();
+            }
+        }
+        if (!slot) slot = ::operator new(sizeof(Task_t));
+        return new (slot) Task_t(ptr, size, name);
+    }
+
+    void put(Task_t *t) {
+        if (t->credits) budget.release(t->credits);
+        t->~Task_t();
+        std::lock_guard<std::mutex> lock(mtx);
+        freeList.push_back(t);
+    }
+
+    std::mutex mtx;
+    std::vector<void*> freeList;
+};
+
+static TaskPool taskPool;
+
+// give back the output buffer of a task to its pool (or free it)
+static inline void releaseOut(Task_t *t) {
+    if (t->pool) t->pool->put(t->ptrOut);
+    else delete [] t->ptrOut;
+    t->ptrOut = nullptr;
+    t->pool = nullptr;
+}
+
+// give back the output buffer and the task itself
+static inline void releaseTask(Task_t *t) {
+    releaseOut(t);
+    taskPool.put(t);
+}
+
+
+// --------------------------------------------------------------------------------------------------- window ------------------
+// Reorder window between the L-Workers and the Writer: block i of a "BIG file" is not sent out until
+// the Writer has written block i - size (-w), so the memory used by a file written in block order (format 1 and 3)
+// is bounded by the window and not by the file size
+struct ReorderWindow {
+    // called by the L-Workers before sending block `blockid` of file `fname`
+    void wait(const std::string &fname, size_t blockid) {
+        if (blockid <= size) return;
+        std::unique_lock<std::mutex> lock(mtx);
+        cv.wait(lock, [&] { return written[fname] + size >= blockid; });
+    }
+
+    // called by the Writer every time it has written the blocks of `fname` up to `blockid`
+    void advance(const std::string &fname, size_t blockid) {
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            written[fname] = blockid;
+        }
+        cv.notify_all();
+    }
+
+    // called by the Writer once all the blocks of `fname` have been written
+    void done(const std::string &fname) {
+        std::lock_guard<std::mutex> lock(mtx);
+        written.erase(fname);
+    }
+
+    size_t size = 1;
+    std::mutex mtx;
+    std::condition_variable cv;
+    std::unordered_map<std::string, size_t> written; // key: filename, value: last block written in order
+};
+
+static ReorderWindow window;
+
+
+// --------------------------------------------------------------------------------------------------- file queue --------------
+// Files shared by all the L-Workers (dynamic scheduling): each L-Worker claims the next one when it is done
+// with the previous file, so the files are spread according to the actual processing time.
+// The files are either listed before the run (when the block size is chosen from the whole input), or claimed
+// while the input is walked by the threads of a FileWalker, so the compression starts with the first files found
+// instead of after the whole tree
+struct FileQueue {
+    FileQueue(std::vector<std::pair<std::string, long>> &&files) : files(std::move(files)) {}
+    FileQueue(FileWalker *walker) : walker(walker) {}
+    ~FileQueue() { delete walker; }
+
+    // the next file with its size, as found by the walk (no stat of the file again)
+    bool pop(std::string &file, long &size) {
+        if (walker) return walker->next(file, size);
+        size_t i = next.fetch_add(1, std::memory_order_relaxed);
+        if (i >= files.size()) return false;
+        file = files[i].first;
+        size = files[i].second;
+        return true;
+    }
+
+    const std::vector<std::pair<std::string, long>> files; // largest first
+    std::atomic<size_t> next{0};
+    FileWalker *walker = nullptr;         // streaming: the files are found while they are claimed
 };
 
 
 // --------------------------------------------------------------------------------------------------- L-worker ----------------
+static std::atomic<size_t> batches{0};          // #batch tasks of "small files" sent by the L-Workers
+static std::atomic<size_t> batchedFiles{0};     // #"small files" sent in those batches
+
 struct L_Worker: ff_monode_t<Task_t> {
-    L_Worker(const std::vector<std::string> &files) : files(files) {}
+    // static scheduling: the worker processes its own partition of the files
+    L_Worker(const std::vector<std::pair<std::string, long>> &files) : files(files) {}
+    // dynamic scheduling: the worker claims the files from the shared queue
+    L_Worker(FileQueue *queue) : queue(queue) {}
+
+    // get the next file to process with its size
+    bool nextFile(std::string &file, long &size) {
+        if (queue) return queue->pop(file, size);
+        if (nfiles == files.size()) return false;
+        file = files[nfiles].first;
+        size = files[nfiles].second;
+        return true;
+    }
 
     bool doWorkCompress(const std::string& fname, size_t size) {
         unsigned char *ptr = nullptr;
@@ -59,14 +476,33 @@ struct L_Worker: ff_monode_t<Task_t> {
             std::fprintf(stderr, "L-Worker: %lu is compressing\n", get_my_id());
         }
 
-		if (!mapFile(fname.c_str(), size, ptr)) return false;
+        // block size of this file
+        const size_t bs = fileBlockSize(size, rworkers);
+        if (AUTO_BLOCK == 2 && QUITE_MODE >= 2) {
+            std::fprintf(stderr, "L-Worker: %lu uses blocks of %zu KB for file %s\n", get_my_id(), bs / 1024, fname.c_str());
+        }
+
+        // "small file": its credits are taken before it is mapped
+        const size_t credits = (size <= bs) ? takeCredits(blockCost(size, 0)) : 0;
+
+		if (!openInput(fname.c_str(), size, ptr)) {
+            if (credits) budget.release(credits);
+            return false;
+        }
 
         if (QUITE_MODE >= 2) {
             std::fprintf(stderr, "L-Worker: %lu has mapped the file\n", get_my_id());
         }
 
-		if (size <= BIGFILE_LOW_THRESHOLD) {
-			Task_t *t = new Task_t(ptr, size, fname);
+		if (size <= bs) {
+			Task_t *t = taskPool.get(ptr, size, fname);
+            t->credits = credits;
+            if (!isRead(size)) prefetch(ptr, size); // read while the file waits in the batch or in the queue of an R-Worker
+
+            if (BATCH && !ARCHIVE) { // the Writer needs a task per file in archive mode
+                addToBatch(t, bs);
+                return true;
+            }
 
             if (QUITE_MODE >= 2) {
                 std::fprintf(stderr, "L-Worker: %lu is sending to the next stage the file %s\n", get_my_id(), fname.c_str());
@@ -74,12 +510,48 @@ struct L_Worker: ff_monode_t<Task_t> {
 
 			ff_send_out(t); // sending to the next stage
 		} else {
-			const size_t fullblocks   = size / BIGFILE_LOW_THRESHOLD;
-			const size_t partialblock = size % BIGFILE_LOW_THRESHOLD;
+			const size_t fullblocks   = size / bs;
+			const size_t partialblock = size % bs;
+            const size_t nblocks      = fullblocks + (partialblock > 0);
+            adviseRange(ptr, size, MADV_SEQUENTIAL);
+
+            // Format 2: the R-Workers write the blocks directly into the output file
+            OutBlocks *out = nullptr;
+            if (FORMAT == 2) {
+                std::string outfile = fname + SUFFIX;
+                int fd = open(outfile.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+                if (fd < 0) {
+                    if (QUITE_MODE >= 1) {
+                        perror("open");
+                        std::fprintf(stderr, "Error opening file %s\n", outfile.c_str());
+                    }
+                    unmapFile(ptr, size);
+                    return false;
+                }
+                out = new OutBlocks(fname, outfile, fd, nblocks);
+                if (CHAIN) { // the blocks read the end of the previous one: the file is unmapped at the end
+                    out->inPtr = ptr;
+                    out->inSize = size;
+                }
+            }
+
 			for(size_t i = 0; i < fullblocks; ++i) {
-				Task_t *t = new Task_t(ptr + (i * BIGFILE_LOW_THRESHOLD), BIGFILE_LOW_THRESHOLD, fname);
+				Task_t *t = taskPool.get(ptr + (i * bs), bs, fname);
 				t->blockid = i + 1;
-				t->nblocks = fullblocks + (partialblock > 0);
+				t->nblocks = nblocks;
+                t->outBlocks = out;
+                if (CHAIN) {
+                    t->dict = dictLen(i * bs);
+                    t->flags = BLOCK_DICT;
+                    if (!out) { // gzip: the Writer unmaps the file
+                        t->mapPtr = ptr;
+                        t->mapSize = size;
+                    }
+                }
+
+                if (!out) window.wait(fname, t->blockid); // do not run too far ahead of the Writer
+                t->credits = takeCredits(blockCost(bs, 0));
+                readAhead(i, nblocks, [&](size_t j) { return std::make_pair(ptr + j * bs, std::min(bs, size - j * bs)); });
 
                 if (QUITE_MODE >= 2) {
                     std::fprintf(stderr, "L-Worker: %lu is sending to the next stage part %zd of the file %s\n", get_my_id(), t->blockid, fname.c_str());
@@ -88,9 +560,21 @@ struct L_Worker: ff_monode_t<Task_t> {
 				ff_send_out(t); // sending to the next stage
 			}
 			if (partialblock) {
-				Task_t *t = new Task_t(ptr + (fullblocks * BIGFILE_LOW_THRESHOLD), partialblock, fname);
+				Task_t *t = taskPool.get(ptr + (fullblocks * bs), partialblock, fname);
 				t->blockid = fullblocks + 1;
 				t->nblocks = fullblocks + 1;
+                t->outBlocks = out;
+                if (CHAIN) {
+                    t->dict = dictLen(fullblocks * bs);
+                    t->flags = BLOCK_DICT;
+                    if (!out) {
+                        t->mapPtr = ptr;
+                        t->mapSize = size;
+                    }
+                }
+
+                if (!out) window.wait(fname, t->blockid);
+                t->credits = takeCredits(blockCost(partialblock, 0));
 
                 if (QUITE_MODE >= 2) {
                     std::fprintf(stderr, "L-Worker: %lu is sending to the next stage part %zd of the file %s that has size %ld\n", get_my_id(), t->blockid, fname.c_str(), partialblock);
@@ -105,87 +589,192 @@ struct L_Worker: ff_monode_t<Task_t> {
     bool doWorkDecompress(const std::string& fname, size_t size) { 
         unsigned char *ptr = nullptr;
 
-        // Map the file into memory
-        if (!mapFile(fname.c_str(), size, ptr)) return false;
+        // Map the file into memory (or read it, if it is small)
+        if (!openInput(fname.c_str(), size, ptr)) return false;
 
-        // Read the first 8 bytes to determine if it was a small or big file
-        size_t nblocks = *reinterpret_cast<size_t *>(ptr);
+        // Read the block index (header or trailer, depending on the format)
+        std::vector<BlockIndex> index;
+        if (!readIndex(ptr, size, index) || index.empty()) {
+            if (QUITE_MODE >= 1) {
+                std::fprintf(stderr, "%s is not a valid compressed file\n", fname.c_str());
+            }
+            if (VERIFY) {
+                ++checkedFiles;
+                ++corruptedFiles;
+            }
+            closeInput(ptr, size);
+            return false;
+        }
+        const size_t nblocks = index.size();
 
         if (QUITE_MODE >= 2) {
             std::fprintf(stderr, "Num of blocks: %zu\n", nblocks);
+            for (size_t i = 0; i < nblocks; ++i) {
+                std::fprintf(stderr, "Original size of block %zu: %zu, compressed size: %zu, offset: %zu\n", i, index[i].size, index[i].cmp_size, index[i].offset);
+            }
         }
 
-        // Initialize a pointer that scrolls the header until it reaches the actual file contents (8 bytes have already been read: nblocks)
-        unsigned char *dataPtr = ptr + sizeof(size_t);  // Move past the 8 bytes of nblocks
-
-        // Retrieve the original and compressed sizes of the blocks
-        std::vector<size_t> Sizes(nblocks);
-        std::vector<size_t> cmpSizes(nblocks);
-        for (size_t i = 0; i < nblocks; ++i) {
-            size_t sizeBlock = *reinterpret_cast<size_t *>(dataPtr);            
-            size_t cmp_sizeBlock = *reinterpret_cast<size_t *>(dataPtr + sizeof(size_t)); 
-            Sizes[i] = sizeBlock; 
-            cmpSizes[i] = cmp_sizeBlock; 
-            dataPtr += 2 * sizeof(size_t); // Move to the next block's size information
-
-            if (QUITE_MODE >= 2) {
-                std::fprintf(stderr, "Original size of block %zu: %zu, compressed size: %zu\n", i, sizeBlock, cmp_sizeBlock);
+        // chained file: each block needs the end of the previous one
+        const bool chained = (index[0].flags & BLOCK_DICT) != 0;
+
+        // "BIG file": create the output file with its final size, the R-Workers will write each block in its place
+        OutMap *out = nullptr;
+        if (nblocks > 1 && !VERIFY) {
+            std::string outfile = fname.substr(0, fname.size() - strlen(SUFFIX));
+            size_t outSize = 0;
+            for (size_t i = 0; i < nblocks; ++i) outSize += index[i].size;
+
+            unsigned char *outPtr = nullptr;
+            if (mapOutFile(outfile.c_str(), outSize, outPtr)) {
+                out = new OutMap(fname, outfile, nblocks);
+                out->outPtr = outPtr;
+                out->outSize = outSize;
+                out->inPtr = ptr;
+                out->inSize = size;
+            } else if (chained) {
+                // the blocks have to be inflated next to the previous ones
+                if (QUITE_MODE >= 1) {
+                    std::fprintf(stderr, "L-Worker: %lu cannot map %s, that is needed to decompress a chained file\n", get_my_id(), outfile.c_str());
+                }
+                closeInput(ptr, size);
+                return false;
+            } else if (QUITE_MODE >= 1) {
+                std::fprintf(stderr, "L-Worker: %lu cannot map %s, its blocks will go through the Writer\n", get_my_id(), outfile.c_str());
             }
         }
 
-        // At this point, dataPtr points to the actual file contents (compressed data)
-        size_t currentOffset = 0; // Offset to locate the data of each block
+        // Test mode: the blocks are only checked
+        CheckFile *check = VERIFY ? new CheckFile(fname, ptr, size, nblocks) : nullptr;
+
+        // chained file: all its blocks go to the same R-Worker, that inflates them in order
+        const size_t rworker = std::hash<std::string>{}(fname) % get_num_outchannels();
+
+        size_t outOffset = 0;     // Offset of each block in the output file
 
         for (size_t i = 0; i < nblocks; ++i) {
-            size_t sizeBlock = Sizes[i]; // This will be used to prepare the buffer for the decompressed data
-            size_t cmp_sizeBlock = cmpSizes[i];
+            size_t sizeBlock = index[i].size; // This will be used to prepare the buffer for the decompressed data
+            size_t cmp_sizeBlock = index[i].cmp_size;
 
             // Create a Task for this block
-            Task_t *task = new Task_t(dataPtr + currentOffset, cmp_sizeBlock, fname);
+            Task_t *task = taskPool.get(ptr + index[i].offset, cmp_sizeBlock, fname);
             task->blockid = i + 1;    // Block identifier
             task->nblocks = nblocks; // Total number of blocks
             task->cmp_size = sizeBlock; // Original size of the block (will be the size of the decompressed data, i.e., the output size)
+            task->flags = index[i].flags;
+            task->crc = index[i].crc;
+            task->mapPtr = ptr;
+            task->check = check;
+            if (chained) task->dict = dictLen(outOffset);
+            task->mapSize = size;
+
+            if (out) {
+                task->outMap = out;
+                task->ptrOut = out->outPtr + outOffset;
+            }
 
             // Adjust the offset for the next block
-            currentOffset += cmp_sizeBlock;
+            outOffset += sizeBlock;
+
+            if (nblocks > 1 && !out && !check) window.wait(fname, task->blockid);
+            task->credits = takeCredits(blockCost(cmp_sizeBlock, sizeBlock));
+            if (!isRead(size)) readAhead(i, nblocks, [&](size_t j) { return std::make_pair(ptr + index[j].offset, index[j].cmp_size); });
 
-            ff_send_out(task);
+            if (chained) ff_send_out_to(task, rworker);
+            else         ff_send_out(task);
         }
         return true;
     }
 
-    Task_t *svc(Task_t *) {
-        // compress or decompress each file assigned to this worker
-        for (const auto &file : files) {
-            struct stat statbuf;
+    // read-ahead while the blocks of a file are sent (-p): with the first block the kernel is asked for the first
+    // PREFETCH blocks, then for one more each time, PREFETCH blocks after the one being sent (range(j): block j)
+    template <typename Range>
+    void readAhead(size_t i, size_t nblocks, Range range) {
+        if (PREFETCH == 0) return;
+        for (size_t j = (i == 0) ? 0 : i + PREFETCH; j <= i + PREFETCH && j < nblocks; ++j) {
+            const auto [p, len] = range(j);
+            prefetch(p, len);
+        }
+    }
 
-            if (stat(file.c_str(), &statbuf) == -1) {
-                std::perror("stat failed");
-                continue; 
-            }
+    // take the credits of a block from the memory budget (-M), it returns the bytes taken; the batch being
+    // filled is sent before waiting, since its credits come back only once it has been compressed
+    size_t takeCredits(size_t bytes) {
+        if (!budget.limit) return 0;
+        if (!budget.tryAcquire(bytes)) {
+            sendBatch();
+            budget.acquire(bytes);
+        }
+        return bytes;
+    }
+
+    // add a "small file" to the batch being filled, that is sent when it is full
+    void addToBatch(Task_t *t, size_t bs) {
+        if (batch) batchTail->next = t;
+        else       batch = t;
+        batchTail = t;
+        ++batchFiles;
+        batchBytes += t->size;
+        if (batchFiles == BATCH_FILES || batchBytes >= bs) sendBatch();
+    }
+
+    void sendBatch() {
+        if (!batch) return;
+        if (QUITE_MODE >= 2) {
+            std::fprintf(stderr, "L-Worker: %lu is sending to the next stage a batch of %zu small files (%zu bytes)\n", get_my_id(), batchFiles, batchBytes);
+        }
+        ff_send_out(batch);
+        ++nbatches;
+        ++batches;
+        batchedFiles += batchFiles;
+        batch = batchTail = nullptr;
+        batchFiles = batchBytes = 0;
+    }
 
+    Task_t *svc(Task_t *) {
+        // compress or decompress each file assigned to (or claimed by) this worker
+        // (the size is the one found by the walk: the file is not stat-ed again)
+        std::string file;
+        long size;
+        for (; nextFile(file, size); ++nfiles) {
             if (comp) {
                 // compress the file
                 if (QUITE_MODE >= 2) {
-                    std::fprintf(stderr, "L-Worker: %lu is compressing file %s of size %lld\n", get_my_id(), file.c_str(), statbuf.st_size);
+                    std::fprintf(stderr, "L-Worker: %lu is compressing file %s of size %ld\n", get_my_id(), file.c_str(), size);
                 }
 
-                if (!doWorkCompress(file, statbuf.st_size)) {
+                if (!doWorkCompress(file, size)) {
                     std::cerr << "Error compressing file: " << file << std::endl;
-                    return EOS;
+                    break;
                 }
             } else {
                 // decompress the file
-                if (!doWorkDecompress(file, statbuf.st_size)) {
+                if (!doWorkDecompress(file, size)) {
                     std::cerr << "Error decompressing file: " << file << std::endl;
-                    return EOS;
+                    if (VERIFY) continue; // the test goes on with the other files
+                    break;
                 }
             }
+            nbytes += size;
         }
+        sendBatch(); // the last one may not be full
         return EOS;
     }
 
-    const std::vector<std::string> files;
+    void svc_end() {
+        if (QUITE_MODE >= 2) {
+            std::fprintf(stderr, "L-Worker %lu: %zu files, %zu bytes, %zu batches\n", get_my_id(), nfiles, nbytes, nbatches);
+        }
+    }
+
+    const std::vector<std::pair<std::string, long>> files;
+    FileQueue *queue = nullptr;
+    size_t nfiles = 0;                  // #files processed
+    size_t nbytes = 0;                  // #bytes of the files processed
+    size_t nbatches = 0;                // #batches of "small files" sent
+    Task_t *batch = nullptr;            // batch being filled: first and last file
+    Task_t *batchTail = nullptr;
+    size_t batchFiles = 0;              // #files and #bytes in the batch being filled
+    size_t batchBytes = 0;
 };
 
 
@@ -198,7 +787,11 @@ struct R_Worker: ff_minode_t<Task_t> {
 
         // Compression part
 		if (comp) {
-			unsigned char * inPtr  = in->ptr;	
+            if (in->next) { // a batch of "small files"
+                compressBatch(in);
+                return GO_ON;
+            }
+
 			size_t          inSize = in->size;
 			
 			// get an estimation of the maximum compression size
@@ -208,96 +801,132 @@ struct R_Worker: ff_minode_t<Task_t> {
                 std::fprintf(stderr, "R-Worker %lu is compressing file %s, block %zd of size %zu. Bound of: %zu\n", get_my_id(), in->filename.c_str(), in->blockid, in->size, cmp_len);
             }
 
-			// allocate memory to store compressed data in memory
-			unsigned char *ptrOut = new unsigned char[cmp_len];
-			if (compress(ptrOut, &cmp_len, (const unsigned char *)inPtr, inSize) != Z_OK) {
-				if (QUITE_MODE >= 1) std::fprintf(stderr, "Failed to compress file in memory\n");
-				success = false;
-				delete [] ptrOut;
-				delete in;
-				return GO_ON;
-			}
+            bool stored = prepareBlock(in);
+            if (!stored) {
+                // get the memory to store compressed data in memory
+                in->ptrOut = getOut(in, cmp_len);
+                if (!compressBlock(in, in->ptrOut, cmp_len)) {
+                    if (QUITE_MODE >= 1) std::fprintf(stderr, "Failed to compress file in memory\n");
+                    success = false;
+                    releaseOut(in);
+                    releaseInput(in);
+                    if (in->outBlocks) {
+                        blockDone(in, false);
+                        return GO_ON;
+                    }
+                    if (!oneblockfile || ARCHIVE) { // the Writer has to know that this block is missing
+                        ff_send_out(in);
+                        return GO_ON;
+                    }
+                    releaseTask(in);
+                    return GO_ON;
+                }
+                // no gain: store the block as it is
+                stored = (FORMAT == 2 && cmp_len >= inSize);
+            }
+            if (stored) {
+                releaseOut(in);
+                in->flags |= BLOCK_STORED;
+                cmp_len = inSize;
+            }
 
-			in->ptrOut   = ptrOut;
 			in->cmp_size = cmp_len;  // now it's the real compression size (see compress in miniz for details)
 
             if (QUITE_MODE >= 2) {
-                std::fprintf(stderr, "R-Worker %lu has compressed file %s of size %zu of block %zd. True size of: %zu\n", get_my_id(), in->filename.c_str(), in->size, in->blockid, cmp_len);
+                std::fprintf(stderr, "R-Worker %lu has compressed file %s of size %zu of block %zd. True size of: %zu%s\n", get_my_id(), in->filename.c_str(), in->size, in->blockid, cmp_len, (in->flags & BLOCK_STORED) ? " (stored)" : "");
+            }
+
+            if (in->outBlocks) {
+                // Format 2: write the block in the output file right now
+                bool ok = in->outBlocks->writeBlock(in);
+                releaseInput(in);
+                if (!ok) success = false;
+                blockDone(in, ok);
+                return GO_ON;
             }
 
-            if (!oneblockfile) {
+            if (!oneblockfile || ARCHIVE) {
+                // The input block is not needed anymore
+                releaseInput(in);
                 // Directly pass the task to the Writer
                 ff_send_out(in);
                 return GO_ON;
             } else { // Single block file case: write the compressed data to a file with header 
-                std::string outfile{in->filename + SUFFIX};
-                FILE *out_fp = std::fopen(outfile.c_str(), "wb");
-                if (!out_fp) {
-                    if (QUITE_MODE >= 1) 
-                        std::fprintf(stderr, "Error opening file %s\n", outfile.c_str());
-                    success = false;
-                    delete [] in->ptrOut;
-                    delete in;
-                    return GO_ON;
+                if (!writeSmallFile(in)) success = false;
+                releaseInput(in);
+                releaseTask(in);
+                return GO_ON;
+            }
+		} else {
+            // Decompression part
+
+            if (in->check) {
+                // Test mode: decompress the block in a buffer of this worker (after the end of the previous
+                // block, if chained) and throw it away
+                in->ptrOut = getOut(in, in->dict + in->cmp_size);
+                unsigned char *out = in->ptrOut + in->dict;
+                bool ok = previousTail(in, in->ptrOut) && decompressBlock(in, out);
+                dropBlock(in);
+                if (in->flags & BLOCK_DICT) keepTail(in, ok, out);
+                if (!ok && QUITE_MODE >= 1) {
+                    std::fprintf(stderr, "R-Worker %lu: block %zu of file %s is corrupted\n", get_my_id(), in->blockid, in->filename.c_str());
                 }
-                
-                // Write the header for the single block file: 1, size, cmp_size (24 bytes)
-                std::fwrite(&in->nblocks, sizeof(in->nblocks), 1, out_fp);
-                std::fwrite(&in->size, sizeof(in->size), 1, out_fp);
-                std::fwrite(&in->cmp_size, sizeof(in->cmp_size), 1, out_fp);
-                
-                // Write the compressed data
-                if (std::fwrite(in->ptrOut, 1, in->cmp_size, out_fp) != in->cmp_size) {
+                if (in->check->blockDone(ok)) {
+                    in->check->close();
+                    delete in->check;
+                }
+                releaseTask(in);
+                return GO_ON;
+            }
+
+            if (in->outMap) {
+                // "BIG file" block: decompress it directly into the mapped output file (a chained block after
+                // the previous one, inflated before by this worker: it is not tried if some block has failed)
+                bool ok = (in->dict == 0 || in->outMap->ok) && decompressBlock(in, in->ptrOut);
+                dropBlock(in); // the compressed file stays mapped until its last block
+                if (!ok) {
                     if (QUITE_MODE >= 1) 
-                        std::fprintf(stderr, "Error writing compressed data to file %s\n", outfile.c_str());
+                        std::fprintf(stderr, "Error decompressing file %s\n", in->filename.c_str());
                     success = false;
                 }
-                
-                std::fclose(out_fp);
-                
-                if (REMOVE_ORIGIN) {
-                    unlink(in->filename.c_str());
+                if (in->outMap->blockDone(ok)) {
+                    if (QUITE_MODE >= 2) {
+                        std::fprintf(stderr, "R-Worker %lu has decompressed the last block of file %s\n", get_my_id(), in->filename.c_str());
+                    }
+                    in->outMap->close();
+                    delete in->outMap;
                 }
-                
-                // Clean up and return
-                unmapFile(in->ptr, in->size);	
-                delete [] in->ptrOut;
-                delete in;
+                in->ptrOut = nullptr; // it points into the output file
+                releaseTask(in);
                 return GO_ON;
             }
-		} else {
-            // Decompression part
 
             // Prepare the buffer to store the decompressed data
             size_t buffer_size = in->cmp_size;
-            unsigned char *buffer = new unsigned char[buffer_size];
+            unsigned char *buffer = in->ptrOut = getOut(in, buffer_size);
 
             if (!oneblockfile) { 
                 // The data to decompress is in the range: [in->ptr, in->ptr + in->size)
-                unsigned char *temp_input_buffer = new unsigned char[in->size];
-                std::memcpy(temp_input_buffer, in->ptr, in->size);
-
-                if (uncompress(buffer, &buffer_size, temp_input_buffer, in->size) != Z_OK) {
+                const bool ok = decompressBlock(in, buffer);
+                dropBlock(in);
+                if (!ok) {
                     if (QUITE_MODE >= 1) 
                         std::fprintf(stderr, "Error decompressing file %s\n", in->filename.c_str());
                     success = false;
-                    delete [] buffer;
-                    delete [] temp_input_buffer;
-                    delete in;
+                    releaseOut(in);
+                    ff_send_out(in); // in->ptrOut is null: the Writer has to know that this block is missing
                     return GO_ON;
                 }
-                delete [] temp_input_buffer;
-                in->ptrOut = buffer;
                 ff_send_out(in);
                 return GO_ON;
             }
             // Single block file case: decompress the data pointed by in->ptr and write it to a file
-            if (uncompress(buffer, &buffer_size, in->ptr, in->size) != Z_OK) {
+            if (!decompressBlock(in, buffer)) {
                 if (QUITE_MODE >= 1) 
                     std::fprintf(stderr, "Error decompressing file %s\n", in->filename.c_str());
                 success = false;
-                delete [] buffer;
-                delete in;
+                closeInput(in->mapPtr, in->mapSize);
+                releaseTask(in);
                 return GO_ON;
             }
             // Write the decompressed data to a file removing the suffix
@@ -307,8 +936,8 @@ struct R_Worker: ff_minode_t<Task_t> {
                 if (QUITE_MODE >= 1) 
                     std::fprintf(stderr, "Error opening file %s\n", outfile.c_str());
                 success = false;
-                delete [] buffer;
-                delete in;
+                closeInput(in->mapPtr, in->mapSize);
+                releaseTask(in);
                 return GO_ON;
             }
             // Write the decompressed data to the file
@@ -324,13 +953,179 @@ struct R_Worker: ff_minode_t<Task_t> {
                 unlink(in->filename.c_str());
             }
             // Clean up and return
-            delete [] buffer;
-            delete in;
+            closeInput(in->mapPtr, in->mapSize);
+            releaseTask(in);
             return GO_ON;
         }  
     }
 
+    // CRC32 of the original block, to be checked when it is decompressed (format 1 has no room for it)
+    // or combined in the gzip trailer; it returns true if the block looks incompressible and has to be
+    // stored as it is (compressing it would only waste CPU time)
+    bool prepareBlock(Task_t *in) {
+        if (FORMAT != 1) {
+            in->crc = blockCrc(in->ptr, in->size);
+            in->flags |= BLOCK_CRC;
+        }
+        return incompressible(in->ptr, in->size);
+    }
+
+    // compress the block into out, cmp_len is the room in out and then the compressed size
+    bool compressBlock(Task_t *in, unsigned char *out, unsigned long &cmp_len) {
+        if (FORMAT == 3) return codec.compressRaw(out, &cmp_len, in->ptr, in->size, in->blockid == in->nblocks, in->dict);
+        return codec.compress(out, &cmp_len, in->ptr, in->size, in->dict);
+    }
+
+    // write the compressed file of a "small file" (a single block, at blockData(in))
+    bool writeSmallFile(Task_t *in) {
+        std::string outfile{in->filename + outSuffix()};
+        FILE *out_fp = std::fopen(outfile.c_str(), "wb");
+        if (!out_fp) {
+            if (QUITE_MODE >= 1) 
+                std::fprintf(stderr, "Error opening file %s\n", outfile.c_str());
+            return false;
+        }
+        
+        if (FORMAT == 1) {
+            // Write the header for the single block file: 1, size, cmp_size (24 bytes)
+            std::fwrite(&in->nblocks, sizeof(in->nblocks), 1, out_fp);
+            std::fwrite(&in->size, sizeof(in->size), 1, out_fp);
+            std::fwrite(&in->cmp_size, sizeof(in->cmp_size), 1, out_fp);
+        }
+        if (FORMAT == 3) std::fwrite(GZ_HEADER, 1, GZ_HEADER_SIZE, out_fp);
+        
+        // Write the compressed data
+        bool ok = true;
+        if (std::fwrite(blockData(in), 1, in->cmp_size, out_fp) != in->cmp_size) {
+            if (QUITE_MODE >= 1) 
+                std::fprintf(stderr, "Error writing compressed data to file %s\n", outfile.c_str());
+            ok = false;
+        }
+
+        if (FORMAT == 2) {
+            // Write the index (one block at offset 0) and the trailer
+            BlockIndex index = {in->size, in->cmp_size, 0, in->flags, in->crc};
+            Trailer trailer = makeTrailer(1);
+            std::fwrite(&index, sizeof(index), 1, out_fp);
+            std::fwrite(&trailer, sizeof(trailer), 1, out_fp);
+        }
+        if (FORMAT == 3) {
+            unsigned char trailer[GZ_TRAILER_SIZE];
+            gzTrailer(trailer, in->crc, in->size);
+            std::fwrite(trailer, 1, GZ_TRAILER_SIZE, out_fp);
+        }
+        
+        std::fclose(out_fp);
+        
+        if (REMOVE_ORIGIN) {
+            unlink(in->filename.c_str());
+        }
+        return ok;
+    }
+
+    // "small files" packed in one task by an L-Worker (linked through next): all of them are compressed
+    // in the same buffer of this worker, then each one is written and released
+    void compressBatch(Task_t *in) {
+        for (Task_t *next; in; in = next) {
+            next = in->next;
+            unsigned long cmp_len = compressBound(in->size);
+            if (batchOut.size() < cmp_len) batchOut.resize(cmp_len);
+
+            bool ok = true;
+            bool stored = prepareBlock(in);
+            if (!stored) {
+                ok = compressBlock(in, batchOut.data(), cmp_len);
+                stored = ok && (FORMAT == 2 && cmp_len >= in->size);
+            }
+            if (ok) {
+                if (stored) {
+                    in->flags |= BLOCK_STORED;
+                    cmp_len = in->size;
+                } else {
+                    in->ptrOut = batchOut.data();
+                }
+                in->cmp_size = cmp_len;
+                ok = writeSmallFile(in);
+                in->ptrOut = nullptr; // not owned by the task
+            } else if (QUITE_MODE >= 1) {
+                std::fprintf(stderr, "Failed to compress file %s in memory\n", in->filename.c_str());
+            }
+            if (!ok) success = false;
+
+            if (QUITE_MODE >= 2) {
+                std::fprintf(stderr, "R-Worker %lu has compressed the small file %s of size %zu in a batch. True size of: %zu%s\n", get_my_id(), in->filename.c_str(), in->size, in->cmp_size, (in->flags & BLOCK_STORED) ? " (stored)" : "");
+            }
+            releaseInput(in);
+            releaseTask(in);
+        }
+    }
+
+    // decompress the block [in->ptr, in->ptr + in->size) into out, that has room for in->cmp_size bytes (the original size),
+    // and check its CRC32 if the index has it
+    bool decompressBlock(Task_t *in, unsigned char *out) {
+        const BlockIndex b = {in->cmp_size, in->size, 0, in->flags, in->crc}; // the task has the sizes swapped
+        return decodeBlock(codec, b, in->ptr, out, in->dict);
+    }
+
+    // test mode, chained block: copy to dictOut the end of the previous block of the file, inflated before by
+    // this worker (all the blocks of a chained file come here, in order), false if it is missing
+    bool previousTail(Task_t *in, unsigned char *dictOut) {
+        if (in->dict == 0) return true;
+        auto it = tails.find(in->filename);
+        if (it == tails.end() || it->second.size() < in->dict) return false;
+        std::memcpy(dictOut, it->second.data() + it->second.size() - in->dict, in->dict);
+        return true;
+    }
+
+    // test mode, chained block: keep the end of the block decompressed at out for the next one of the file
+    void keepTail(Task_t *in, bool ok, const unsigned char *out) {
+        if (ok && in->blockid < in->nblocks) {
+            const size_t len = std::min(in->cmp_size, (size_t)DICT_SIZE);
+            tails[in->filename].assign(out + in->cmp_size - len, out + in->cmp_size);
+        } else {
+            tails.erase(in->filename);
+        }
+    }
+
+    // release the input of a compressed block: a "small file" is closed, the pages of a block of a "BIG file" are
+    // unmapped (blocks are page aligned) unless the next block reads its end as dictionary (then they are dropped)
+    void releaseInput(Task_t *in) {
+        if (in->nblocks == 1) closeInput(in->ptr, in->size);
+        else if (in->mapPtr || (in->outBlocks && in->outBlocks->inPtr)) dropPages(in->ptr, in->size);
+        else unmapFile(in->ptr, in->size);
+    }
+
+    // decompression: the compressed block has been consumed, its pages can go (the file stays mapped until its last block)
+    void dropBlock(Task_t *in) {
+        if (!isRead(in->mapSize)) dropPages(in->ptr, in->size);
+    }
+
+    // a block of a format 2 file has been written (or lost): the last one closes the file
+    void blockDone(Task_t *in, bool ok) {
+        if (in->outBlocks->blockDone(ok)) {
+            if (QUITE_MODE >= 2) {
+                std::fprintf(stderr, "R-Worker %lu has written the last block of file %s\n", get_my_id(), in->filename.c_str());
+            }
+            in->outBlocks->close();
+            delete in->outBlocks;
+        }
+        releaseTask(in);
+    }
+
+    // get an output buffer of at least `size` bytes, from the pool if it fits in its buffers
+    unsigned char *getOut(Task_t *t, size_t size) {
+        if (size <= pool.bufSize) {
+            t->pool = &pool;
+            return pool.get();
+        }
+        t->pool = nullptr;
+        return new unsigned char[size];
+    }
+
     void svc_end() {
+        if (QUITE_MODE >= 2) {
+            std::fprintf(stderr, "R-Worker %ld: %zu output buffers of %zu bytes allocated\n", get_my_id(), pool.allocated, pool.bufSize);
+        }
 		if (!success) {
 			if (QUITE_MODE>=1) std::fprintf(stderr, "R-Worker %ld: Exiting with (some) Error(s)\n", get_my_id());
 			return;
@@ -339,130 +1134,463 @@ struct R_Worker: ff_minode_t<Task_t> {
 
     bool success = true;
     const size_t Lw;
+    // output buffers of this worker, sized for a full block: compressBound(BIGFILE_LOW_THRESHOLD) or BIGFILE_LOW_THRESHOLD
+    BufferPool pool{comp ? compressBound(BIGFILE_LOW_THRESHOLD) : BIGFILE_LOW_THRESHOLD};
+    // deflate/inflate state of this worker, reused for all its blocks
+    Codec codec{LEVEL, STRATEGY};
+    // output buffer of the batches of "small files", reused for all of them
+    std::vector<unsigned char> batchOut;
+    // test mode: the end of the last block checked of each chained file
+    std::map<std::string, std::vector<unsigned char>> tails;
 };
 
 
 // --------------------------------------------------------------------------------------------------- writer ------------------
+// Writes the "small files" and the files that go out in block order: in format 1 it appends the blocks of a "BIG file"
+// as soon as all the previous ones have been written (the header is reserved when the first block arrives and filled
+// in at the end), in format 3 it writes the gzip header, the raw deflate blocks in order and the trailer with the
+// CRC32s of the blocks combined (with -d 1 the input file stays mapped until the file is closed here).
+// In archive mode all the blocks go through it, see "Archive mode" below
 struct Writer: ff_minode_t<Task_t> {
     Writer(const size_t Rw) : Rw(Rw) {}
 
-    Task_t *svc(Task_t *in) {
-        if (QUITE_MODE >= 2) {
-            std::fprintf(stderr, "Welcome, I am the Writer and I received the block %zu of file %s\n", in->blockid, in->filename.c_str());
+    // An output file that is being filled in block order
+    struct OutFile {
+        FILE *fp = nullptr;
+        std::string outfile;
+        size_t nblocks = 0;
+        size_t next = 1;                        // next block to append
+        std::map<size_t, Task_t*> pending;      // blocks arrived before `next` (at most `window.size`)
+        std::vector<size_t> Sizes;              // header entries, filled in as the blocks are appended
+        std::vector<size_t> cmpSizes;
+        unsigned char *mapPtr = nullptr;        // decompression, chained gzip: mapped input file
+        size_t mapSize = 0;
+        size_t crc = MZ_CRC32_INIT;             // gzip, archive: CRC32 and size of the blocks appended so far
+        size_t size = 0;
+        std::vector<unsigned char> member;      // archive: data kept while another member is being written,
+        FILE *spill = nullptr;                  //   and its part beyond the memory budget (-M)
+        size_t credits = 0;                     // archive: bytes of the budget taken by `member`
+        size_t cmpSize = 0;                     // archive: compressed size of the blocks appended so far
+        uint64_t offset = 0;                    // archive: local header of the member
+        uint16_t dosTime = 0, dosDate = 0;
+        bool zip64 = false;
+        bool complete = false;                  // archive: all the blocks appended, the member can be closed
+        bool ok = true;
+    };
+
+    // Open the output file when the first block of a file arrives
+    void openOut(OutFile &f, Task_t *in) {
+        f.nblocks = in->nblocks;
+        f.mapPtr  = in->mapPtr;
+        f.mapSize = in->mapSize;
+
+        if (comp && archive) {
+            f.outfile = in->filename;
+            return;
+        }
+        if (comp) {
+            f.outfile = in->filename + outSuffix();
+        } else {
+            f.outfile = in->filename.substr(0, in->filename.size() - strlen(SUFFIX));
+        }
+        f.fp = std::fopen(f.outfile.c_str(), "wb");
+        if (!f.fp) {
+            std::cerr << "Error opening file for writing: " << f.outfile << std::endl;
+            f.ok = false;
+            return;
         }
 
-        // Insert the current task into the map
-        auto& fileEntry = fileMap[in->filename];
-        fileEntry.first = in->nblocks;
-        fileEntry.second.push_back(in);
-
-        // Check if all blocks for the file are collected
-        if (fileEntry.second.size() == fileEntry.first) {
+        if (comp && FORMAT == 3) {
+            // gzip: the header does not depend on the blocks
+            if (std::fwrite(GZ_HEADER, 1, GZ_HEADER_SIZE, f.fp) != GZ_HEADER_SIZE) f.ok = false;
+        } else if (comp) {
+            // Write first element of the header: nblocks, and leave room for the sizes of the blocks
+            std::fwrite(&f.nblocks, sizeof(size_t), 1, f.fp);
+            std::fseek(f.fp, sizeof(size_t) + f.nblocks * 2 * sizeof(size_t), SEEK_SET);
+            f.Sizes.reserve(f.nblocks);
+            f.cmpSizes.reserve(f.nblocks);
 
             if (QUITE_MODE >= 2) {
-                std::fprintf(stderr, "Writer: I have received all the blocks for file %s (last block was: %zu)\n", in->filename.c_str(), in->blockid);
+                std::fprintf(stderr, "Number of blocks is %zu\n", f.nblocks);
             }
+        }
+    }
 
-            // Sort blocks by block ID
-            auto& blocks = fileEntry.second;
-            std::sort(blocks.begin(), blocks.end(), [](Task_t* a, Task_t* b) {
-                return a->blockid < b->blockid;
-            });
+    // Append one block to the output file and free it
+    void appendBlock(OutFile &f, Task_t *task) {
+        if (!task->ptrOut) f.ok = false; // the block could not be (de)compressed
+
+        if (f.ok && archive) {
+            // the first file that has data becomes the member being written, the others keep it for later
+            if (head.empty()) f.ok = beginMember(task->filename, f);
+            if (f.ok && task->filename == head) f.ok = writeArchive(task->ptrOut, task->cmp_size);
+            else if (f.ok) f.ok = keepData(f, task->ptrOut, task->cmp_size);
+            f.crc = crc32Combine(f.crc, task->crc, task->size);
+            f.size += task->size;
+            f.cmpSize += task->cmp_size;
+        } else if (f.ok) {
+            // in compression cmp_size is the compressed size, in decompression it is the original size
+            if (std::fwrite(task->ptrOut, 1, task->cmp_size, f.fp) != task->cmp_size) {
+                std::cerr << "Error writing to file: " << f.outfile << std::endl;
+                f.ok = false;
+            }
+            f.Sizes.push_back(task->size);
+            f.cmpSizes.push_back(task->cmp_size);
+            if (comp && FORMAT == 3) {
+                f.crc = crc32Combine(f.crc, task->crc, task->size);
+                f.size += task->size;
+            }
+        }
 
-            if (QUITE_MODE >= 2) {
-                std::fprintf(stderr, "Writer: I have sorted the blocks for file %s\n", in->filename.c_str());
-                for (auto& task : blocks) {
-                    std::fprintf(stderr, "Block %zu\n", task->blockid);
+        if (QUITE_MODE >= 2) {
+            std::fprintf(stderr, "Writer: block %zu of file %s appended (original size %zu, cmp_size %zu)\n", task->blockid, task->filename.c_str(), task->size, task->cmp_size);
+        }
+
+        releaseTask(task);
+    }
+
+    // All the blocks have been appended: complete the header and close the output file
+    void closeOut(const std::string &filename, OutFile &f) {
+        if (f.fp) {
+            if (comp && f.ok && FORMAT == 3) {
+                unsigned char trailer[GZ_TRAILER_SIZE];
+                gzTrailer(trailer, f.crc, f.size);
+                if (std::fwrite(trailer, 1, GZ_TRAILER_SIZE, f.fp) != GZ_TRAILER_SIZE) f.ok = false;
+            } else if (comp && f.ok) {
+                // Write each block's size and compressed size
+                std::fseek(f.fp, sizeof(size_t), SEEK_SET);
+                for (size_t i = 0; i < f.nblocks; ++i) {
+                    std::fwrite(&f.Sizes[i], sizeof(size_t), 1, f.fp);
+                    std::fwrite(&f.cmpSizes[i], sizeof(size_t), 1, f.fp);
                 }
             }
+            if (std::fclose(f.fp) != 0) f.ok = false;
+            if (!f.ok) unlink(f.outfile.c_str()); // do not leave a truncated file around
+        }
 
-            // Compression: write the compressed data to a file (adding the suffix) with the header
-            if (comp) {
-                // Write compressed file
-                std::string outfile = blocks[0]->filename + SUFFIX;
-                FILE* out_fp = std::fopen(outfile.c_str(), "wb");
-                if (!out_fp) {
-                    std::cerr << "Error opening file for writing: " << outfile << std::endl;
-                    return GO_ON;
-                }
+        if (archive) {
+            if (f.mapPtr) closeInput(f.mapPtr, f.mapSize);
+            f.complete = true; // the member is closed by nextMember
+            return;
+        }
 
-                // Write first element of the header: nblocks
-                std::fwrite(&blocks[0]->nblocks, sizeof(size_t), 1, out_fp);
+        if (f.mapPtr) closeInput(f.mapPtr, f.mapSize);
 
-                if (QUITE_MODE >= 2) {
-                    std::fprintf(stderr, "Number of blocks is %zu\n", blocks[0]->nblocks);
-                }
+        // Remove original file if flag is set
+        if (f.ok && REMOVE_ORIGIN) {
+            unlink(filename.c_str());
+        }
+        if (!f.ok) success = false;
+    }
 
-                // Write each block's size and compressed size
-                for (auto& task : blocks) {
-                    std::fwrite(&task->size, sizeof(size_t), 1, out_fp);
-                    std::fwrite(&task->cmp_size, sizeof(size_t), 1, out_fp);
-                }
+    // Archive mode -------------------------------------------------------------------------------------------
+    // One member at a time is written in the archive, block after block as they arrive in order. The blocks of the
+    // other files are kept (in memory within the budget -M, beyond it in a temporary file) until their turn comes.
 
-                if (QUITE_MODE >= 2) {
-                    for (auto& task : blocks) {
-                        std::fprintf(stderr, "Original size %zu, cmp_size %zu\n", task->size, task->cmp_size);
-                    }
-                }
+    // write to the archive
+    bool writeArchive(const void *data, size_t n) {
+        if (std::fwrite(data, 1, n, archive) != n) {
+            if (QUITE_MODE >= 1) std::fprintf(stderr, "Writer: error writing the archive %s\n", ARCHIVE);
+            return false;
+        }
+        archiveSize += n;
+        return true;
+    }
 
-                // Write compressed data
-                for (auto& task : blocks) {
-                    std::fwrite(task->ptrOut, 1, task->cmp_size, out_fp);
-                }
+    // keep the data of a file that is not the member being written
+    bool keepData(OutFile &f, const unsigned char *data, size_t n) {
+        if (!f.spill && (!budget.limit || budget.tryAcquireLeaving(n, blockCost(BIGFILE_LOW_THRESHOLD, 0)))) {
+            if (budget.limit) f.credits += n;
+            f.member.insert(f.member.end(), data, data + n);
+            return true;
+        }
+        if (!f.spill && !(f.spill = std::tmpfile())) {
+            std::cerr << "Error creating a temporary file for: " << f.outfile << std::endl;
+            return false;
+        }
+        if (std::fwrite(data, 1, n, f.spill) != n) {
+            std::cerr << "Error writing a temporary file for: " << f.outfile << std::endl;
+            return false;
+        }
+        return true;
+    }
 
-                std::fclose(out_fp);
+    // free the data kept for a file (written or not)
+    void dropData(OutFile &f) {
+        std::vector<unsigned char>().swap(f.member);
+        if (f.credits) budget.release(f.credits);
+        f.credits = 0;
+        if (f.spill) std::fclose(f.spill);
+        f.spill = nullptr;
+    }
 
-            } else { // Decompression: write the decompressed data to a file (removing the suffix)
-                std::string outfile = blocks[0]->filename.substr(0, blocks[0]->filename.size() - strlen(SUFFIX));
-                FILE* out_fp = std::fopen(outfile.c_str(), "wb");
-                if (!out_fp) {
-                    std::cerr << "Error opening file for writing: " << outfile << std::endl;
-                    return GO_ON;
-                }
+    // name of a member: the file name without the leading '/', as zip does
+    static std::string memberName(const OutFile &f) {
+        const size_t skip = f.outfile.find_first_not_of('/');
+        return f.outfile.substr(skip == std::string::npos ? 0 : skip);
+    }
 
-                // Write decompressed data
-                for (auto& task : blocks) {
-                    std::fwrite(task->ptrOut, 1, task->cmp_size, out_fp);
-                    delete[] task->ptrOut;
-                }
+    // the file becomes the member being written: its local header, then the data kept so far
+    bool beginMember(const std::string &filename, OutFile &f) {
+        head = filename;
+        f.offset = archiveSize;
+        if (!f.ok) {
+            dropData(f);
+            return false;
+        }
 
-                std::fclose(out_fp);
+        const std::string name = memberName(f);
+        struct stat st;
+        const bool known = stat(f.outfile.c_str(), &st) == 0;
+        dosTime(known ? st.st_mtime : std::time(nullptr), f.dosTime, f.dosDate);
+        // the compressed data of a file of 2 Gbyte or more could not fit in 32 bits: zip64 sizes
+        f.zip64 = !known || (uint64_t)st.st_size >= ZIP_MAX32 / 2;
+        if (name.size() > 0xFFFF) {
+            if (QUITE_MODE >= 1) std::fprintf(stderr, "Writer: the name of %s is too long for the archive\n", f.outfile.c_str());
+            dropData(f);
+            return false;
+        }
 
-            }
+        unsigned char hdr[ZIP_LOCAL_HEADER_SIZE];
+        unsigned char *p = putLE(hdr, 0x04034b50, 4);
+        p = putLE(p, f.zip64 ? 45 : 20, 2);                 // version needed
+        p = putLE(p, ZIP_FLAGS, 2);
+        p = putLE(p, MZ_DEFLATED, 2);
+        p = putLE(p, f.dosTime, 2);
+        p = putLE(p, f.dosDate, 2);
+        p = putLE(p, 0, 4);                                 // CRC32 and sizes: in the data descriptor
+        p = putLE(p, f.zip64 ? ZIP_MAX32 : 0, 4);
+        p = putLE(p, f.zip64 ? ZIP_MAX32 : 0, 4);
+        p = putLE(p, name.size(), 2);
+        putLE(p, f.zip64 ? 20 : 0, 2);                      // extra field
+        bool ok = writeArchive(hdr, sizeof(hdr)) && writeArchive(name.data(), name.size());
+        if (ok && f.zip64) {
+            unsigned char extra[20] = {};
+            putLE(putLE(extra, 1, 2), 16, 2);               // zip64 sizes, filled in by the descriptor
+            ok = writeArchive(extra, sizeof(extra));
+        }
 
-            // Remove original file if flag is set
-            if (REMOVE_ORIGIN) {
-                unlink(blocks[0]->filename.c_str());
+        ok = ok && writeArchive(f.member.data(), f.member.size());
+        if (ok && f.spill) {
+            std::vector<unsigned char> buf(BUF_SIZE);
+            std::rewind(f.spill);
+            size_t n;
+            while (ok && (n = std::fread(buf.data(), 1, buf.size(), f.spill)) > 0) ok = writeArchive(buf.data(), n);
+            if (std::ferror(f.spill)) ok = false;
+        }
+        dropData(f);
+        return ok;
+    }
+
+    // close the member being written with its data descriptor and add its central directory entry;
+    // a member with errors is taken back, the next one is written over it
+    void endMember(const std::string &filename, OutFile &f) {
+        head.clear();
+        const std::string name = memberName(f);
+        if (f.ok) {
+            unsigned char desc[24];
+            unsigned char *p = putLE(desc, 0x08074b50, 4);
+            p = putLE(p, f.crc, 4);
+            p = putLE(p, f.cmpSize, f.zip64 ? 8 : 4);
+            p = putLE(p, f.size, f.zip64 ? 8 : 4);
+            f.ok = writeArchive(desc, p - desc);
+        }
+        if (!f.ok) {
+            archiveSize = f.offset;
+            fseeko(archive, (off_t)archiveSize, SEEK_SET);
+            if (QUITE_MODE >= 1) std::fprintf(stderr, "Writer: cannot add %s to the archive\n", name.c_str());
+            success = false;
+            return;
+        }
+
+        // the zip64 extra field has the values that do not fit in their 32 bits field
+        const bool bigSize = f.size >= ZIP_MAX32, bigCmp = f.cmpSize >= ZIP_MAX32, bigOffset = f.offset >= ZIP_MAX32;
+        unsigned char extra[28];
+        unsigned char *e = extra + 4;
+        if (bigSize)   e = putLE(e, f.size, 8);
+        if (bigCmp)    e = putLE(e, f.cmpSize, 8);
+        if (bigOffset) e = putLE(e, f.offset, 8);
+        const size_t extraSize = (e == extra + 4) ? 0 : e - extra;
+        putLE(putLE(extra, 1, 2), extraSize - 4, 2);
+
+        unsigned char hdr[ZIP_CENTRAL_HEADER_SIZE];
+        unsigned char *p = putLE(hdr, 0x02014b50, 4);
+        const int version = (f.zip64 || extraSize) ? 45 : 20;
+        p = putLE(p, version, 2);                           // made by (MS-DOS attributes)
+        p = putLE(p, version, 2);                           // needed
+        p = putLE(p, ZIP_FLAGS, 2);
+        p = putLE(p, MZ_DEFLATED, 2);
+        p = putLE(p, f.dosTime, 2);
+        p = putLE(p, f.dosDate, 2);
+        p = putLE(p, f.crc, 4);
+        p = putLE(p, bigCmp ? ZIP_MAX32 : f.cmpSize, 4);
+        p = putLE(p, bigSize ? ZIP_MAX32 : f.size, 4);
+        p = putLE(p, name.size(), 2);
+        p = putLE(p, extraSize, 2);
+        p = putLE(p, 0, 2 + 2 + 2 + 4);                     // comment, disk, internal and external attributes
+        putLE(p, bigOffset ? ZIP_MAX32 : f.offset, 4);
+        central.insert(central.end(), hdr, hdr + sizeof(hdr));
+        central.insert(central.end(), name.begin(), name.end());
+        central.insert(central.end(), extra, extra + extraSize);
+        ++members;
+
+        // the original files are removed when the archive is complete
+        if (REMOVE_ORIGIN) added.push_back(filename);
+        if (QUITE_MODE >= 2) {
+            std::fprintf(stderr, "Writer: %s added to the archive (%zu -> %zu bytes)\n", name.c_str(), f.size, f.cmpSize);
+        }
+    }
+
+    // When the member being written is complete, the next one is a file whose blocks have all been appended
+    // (its data goes in at once), otherwise the file with the most data kept
+    void nextMember() {
+        for (;;) {
+            if (!head.empty()) {
+                auto it = fileMap.find(head);
+                if (!it->second.complete) return;
+                endMember(it->first, it->second);
+                fileMap.erase(it);
+            }
+            auto next = fileMap.end();
+            for (auto it = fileMap.begin(); it != fileMap.end(); ++it) {
+                const OutFile &f = it->second;
+                if (next == fileMap.end() || std::make_pair(f.complete, f.cmpSize) > std::make_pair(next->second.complete, next->second.cmpSize)) {
+                    next = it;
+                }
             }
+            if (next == fileMap.end() || (!next->second.complete && next->second.cmpSize == 0)) return;
+            next->second.ok = beginMember(next->first, next->second);
+        }
+    }
 
-            fileMap.erase(in->filename);
+    // the central directory and the end of the archive (zip64 if some of its values do not fit)
+    bool endArchive() {
+        const uint64_t cdOffset = archiveSize, cdSize = central.size();
+        bool ok = writeArchive(central.data(), central.size());
+        if (members >= 0xFFFF || cdOffset >= ZIP_MAX32 || cdSize >= ZIP_MAX32) {
+            const uint64_t end64 = archiveSize;
+            unsigned char rec[ZIP64_END_SIZE + ZIP64_LOCATOR_SIZE];
+            unsigned char *p = putLE(rec, 0x06064b50, 4);
+            p = putLE(p, ZIP64_END_SIZE - 12, 8);
+            p = putLE(p, 45, 2);
+            p = putLE(p, 45, 2);
+            p = putLE(p, 0, 4 + 4);                         // disks
+            p = putLE(p, members, 8);
+            p = putLE(p, members, 8);
+            p = putLE(p, cdSize, 8);
+            p = putLE(p, cdOffset, 8);
+            p = putLE(p, 0x07064b50, 4);                    // locator
+            p = putLE(p, 0, 4);
+            p = putLE(p, end64, 8);
+            putLE(p, 1, 4);
+            ok = ok && writeArchive(rec, sizeof(rec));
         }
+        unsigned char end[ZIP_END_SIZE];
+        unsigned char *p = putLE(end, 0x06054b50, 4);
+        p = putLE(p, 0, 2 + 2);                             // disks
+        p = putLE(p, std::min(members, (size_t)0xFFFF), 2);
+        p = putLE(p, std::min(members, (size_t)0xFFFF), 2);
+        p = putLE(p, std::min(cdSize, ZIP_MAX32), 4);
+        p = putLE(p, std::min(cdOffset, ZIP_MAX32), 4);
+        putLE(p, 0, 2);                                     // comment
+        ok = ok && writeArchive(end, sizeof(end));
+
+        // a member taken back at the end may have left some bytes after the end of the archive
+        ok = (std::fflush(archive) == 0) && ok;
+        if (ok && ftruncate(fileno(archive), (off_t)archiveSize) != 0) ok = false;
+        ok = (std::fclose(archive) == 0) && ok;
+        archive = nullptr;
+        return ok;
+    }
 
+    Task_t *svc(Task_t *in) {
         if (QUITE_MODE >= 2) {
-            std::fprintf(stderr, "Goodbye, I am the Writer and I have written the block %zu of file %s\n", in->blockid, in->filename.c_str());
+            std::fprintf(stderr, "Welcome, I am the Writer and I received the block %zu of file %s\n", in->blockid, in->filename.c_str());
+        }
+
+        const std::string filename = in->filename;
+        OutFile &f = fileMap[filename];
+        if (f.nblocks == 0) openOut(f, in);
+
+        // Append all the blocks that are now in order
+        f.pending[in->blockid] = in;
+        size_t first = f.next;
+        while (!f.pending.empty() && f.pending.begin()->first == f.next) {
+            appendBlock(f, f.pending.begin()->second);
+            f.pending.erase(f.pending.begin());
+            ++f.next;
+        }
+        if (f.next != first) window.advance(filename, f.next - 1);
+
+        // Check if all blocks for the file have been written
+        if (f.next > f.nblocks) {
+            if (QUITE_MODE >= 2) {
+                std::fprintf(stderr, "Writer: I have written all the blocks for file %s\n", filename.c_str());
+            }
+            closeOut(filename, f);
+            window.done(filename);
+            if (!archive) fileMap.erase(filename);
         }
+        if (archive) nextMember();
 
         return GO_ON;
     }
 
     void svc_end() {
-        for (auto& [filename, fileData] : fileMap) {
-            auto& blocks = fileData.second;
-            for (auto task : blocks) {
-                unmapFile(task->ptr, task->size);
-                delete task;
+        // files still open here have some blocks missing
+        for (auto& [filename, f] : fileMap) {
+            if (f.complete) continue; // archive: waiting for its turn
+            for (auto& [blockid, task] : f.pending) {
+                releaseTask(task);
+            }
+            f.ok = false;
+            closeOut(filename, f);
+        }
+
+        // Archive mode: the members still waiting, then the central directory; the original files can go
+        if (archive) {
+            nextMember();
+            if (!endArchive()) {
+                if (QUITE_MODE >= 1) std::fprintf(stderr, "Writer: cannot finalize the archive %s\n", ARCHIVE);
+                success = false;
+            }
+            if (success) {
+                for (const auto &filename : added) unlink(filename.c_str());
             }
         }
         fileMap.clear();
+
+        if (!success) {
+            if (QUITE_MODE >= 1) std::fprintf(stderr, "Writer: Exiting with (some) Error(s)\n");
+        }
     }
 
-    // Key: filename, value: pair <nblocks, vector of blocks>
-    std::unordered_map<std::string, std::pair<size_t, std::vector<Task_t*>>> fileMap;
+    // Key: filename, value: output file being written
+    std::unordered_map<std::string, OutFile> fileMap;
+
+    FILE *archive = nullptr;            // archive mode: the archive being written
+    uint64_t archiveSize = 0;           //   bytes written (the next member starts here)
+    std::string head;                   //   file of the member being written ("": none)
+    std::vector<unsigned char> central; //   central directory entries of the members written
+    size_t members = 0;
+    std::vector<std::string> added;     // archive mode: files to remove once the archive is complete (-C 1)
 
+    bool success = true;
     const size_t Rw;
 };
 
 
+// --------------------------------------------------------------------------------------------------- writer router -----------
+// More Writers (-W): the emitter of the farm of the Writers. All the blocks of a file go to the same Writer,
+// chosen by the hash of the file name, so each Writer orders and closes its own files without sharing any state
+struct WriterRouter: ff_monode_t<Task_t> {
+    Task_t *svc(Task_t *in) {
+        ff_send_out_to(in, std::hash<std::string>{}(in->filename) % get_num_outchannels());
+        return GO_ON;
+    }
+};
+
+
 // --------------------------------------------------------------------------------------------------- main --------------------
 int main(int argc, char *argv[]) {
     if (argc < 2) {
@@ -475,21 +1603,63 @@ int main(int argc, char *argv[]) {
 
     const size_t Lw = lworkers;
     const size_t Rw = rworkers;
+    const size_t Ww = wworkers;
+
+    // Size of the reorder window of the Writer (in blocks per file)
+    window.size = (wblocks > 0) ? wblocks : 2 * Rw;
+    budget.limit = MEMORY_BUDGET;
+    if (READ_THRESHOLD > 0) readPool = new BufferPool(READ_THRESHOLD);
 
     // Start the timer (identical to chrono misurations)
     ffTime(START_TIME);
 
-    // Distribute the workload among the Lw L-workers
-    std::vector<std::vector<std::string>> partitions = partitionInput(start, argv, argc, Lw);
+    // Distribute the workload among the Lw L-workers: statically, or through a queue from which
+    // they claim the files at run time. The whole input is listed upfront only when it is needed (static
+    // scheduling, block size chosen from the input), otherwise it is walked while the files are processed
+    const bool stream = DYNAMIC && !(comp && AUTO_BLOCK);
+    std::vector<std::pair<std::string, long>> inputFiles;
+    if (!stream) inputFiles = getInputFiles(start, argv, argc);
+    std::vector<std::vector<std::pair<std::string, long>>> partitions;
+    FileQueue *queue = nullptr;
+
+    // Choose the block size from the input, if requested
+    if (comp && AUTO_BLOCK) {
+        size_t totalBytes = 0;
+        for (const auto &[file, size] : inputFiles) totalBytes += size;
+        BIGFILE_LOW_THRESHOLD = autoBlockSize(totalBytes, inputFiles.size(), Rw);
+        if (QUITE_MODE >= 1) {
+            std::cout << "Block size: " << BIGFILE_LOW_THRESHOLD / 1024 << " KB (" << inputFiles.size() << " files, " << totalBytes << " bytes, " << Rw << " R-Workers)" << std::endl;
+        }
+    }
+
+    if (stream) {
+        queue = new FileQueue(new FileWalker(start, argv, argc, acceptFile, RECUR, QUITE_MODE));
+
+        if (QUITE_MODE >= 1) {
+            std::cout << "File queue: claimed while the input is walked (largest first among up to " << LOOKAHEAD << " files)" << std::endl;
+        }
+    } else if (DYNAMIC) {
+        queue = new FileQueue(queueInput(inputFiles));
 
-    // If quiet >= 1 print the partitions
-    if (QUITE_MODE >= 1) {
-        for (size_t i = 0; i < partitions.size(); ++i) {
-            std::cout << "Partition " << i << ":\n";
-            for (const auto& file : partitions[i]) {
+        // If quiet >= 1 print the queue
+        if (QUITE_MODE >= 1) {
+            std::cout << "File queue:\n";
+            for (const auto &[file, size] : queue->files) {
                 std::cout << file << std::endl;
             }
         }
+    } else {
+        partitions = partitionInput(inputFiles, Lw);
+
+        // If quiet >= 1 print the partitions
+        if (QUITE_MODE >= 1) {
+            for (size_t i = 0; i < partitions.size(); ++i) {
+                std::cout << "Partition " << i << ":\n";
+                for (const auto &[file, size] : partitions[i]) {
+                    std::cout << file << std::endl;
+                }
+            }
+        }
     }
 
     // Define the FastFlow network ----------------------
@@ -497,7 +1667,8 @@ int main(int argc, char *argv[]) {
     std::vector<ff_node*> RW;
 
     for (size_t i = 0; i < Lw; ++i) {
-        LW.push_back(new L_Worker(partitions[i]));
+        if (DYNAMIC) LW.push_back(new L_Worker(queue));
+        else         LW.push_back(new L_Worker(partitions[i]));
     }
 
     for (size_t i = 0; i < Rw; ++i) {
@@ -508,9 +1679,34 @@ int main(int argc, char *argv[]) {
     a2a.add_firstset(LW);
     a2a.add_secondset(RW);
 
-    Writer writer(Rw);
+    std::vector<ff_node*> WW;
+    for (size_t i = 0; i < Ww; ++i) {
+        WW.push_back(new Writer(Rw));
+    }
+
+    // Archive mode: the Writer writes the members one after the other (there is only one Writer)
+    if (ARCHIVE) {
+        FILE *archive = std::fopen(ARCHIVE, "wb");
+        if (!archive) {
+            std::fprintf(stderr, "Error: cannot create the archive %s\n", ARCHIVE);
+            return -1;
+        }
+        static_cast<Writer*>(WW[0])->archive = archive;
+    }
 
-    ff_Pipe<> pipe(a2a, writer);
+    // One Writer is the last stage of the pipeline, more Writers are the workers of a farm (without collector)
+    // whose emitter routes the blocks by file
+    ff_pipeline pipe;
+    ff_farm writers;
+    pipe.add_stage(&a2a);
+    if (Ww == 1) {
+        pipe.add_stage(WW[0]);
+    } else {
+        writers.add_emitter(new WriterRouter);
+        writers.add_workers(WW);
+        writers.remove_collector();
+        pipe.add_stage(&writers);
+    }
 
     pipe.blocking_mode(BLOCKING); 
 
@@ -519,6 +1715,9 @@ int main(int argc, char *argv[]) {
         return -1;
     }
     // --------------------------------------------------
+    delete queue;
+    if (QUITE_MODE >= 2 && readPool) std::fprintf(stderr, "Input buffers of %zu bytes allocated: %zu\n", readPool->bufSize, readPool->allocated);
+    delete readPool;
 
     // Stop the timer
     ffTime(STOP_TIME);
@@ -527,6 +1726,12 @@ int main(int argc, char *argv[]) {
     std::cout << "Elapsed time: " << ffTime(GET_TIME) / 1000.0 << " s\n";
 
     if (QUITE_MODE >= 1) std::cout << "pipe(a2a, writer) Time: " << pipe.ffTime() << " (ms)\n";
+    if (comp && QUITE_MODE >= 1) std::cout << "Batches: " << batches << " (" << batchedFiles << " small files)\n";
+    if (budget.limit && QUITE_MODE >= 1) std::cout << "Memory budget: peak " << budget.peak / (1024 * 1024) << " of " << budget.limit / (1024 * 1024) << " MB\n";
 
+    if (VERIFY) {
+        std::cout << "Checked " << checkedFiles << " files, " << corruptedFiles << " corrupted\n";
+        return (corruptedFiles > 0) ? 1 : 0;
+    }
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,107 @@
+#if !defined _MAPPING_HPP_ff
+#define _MAPPING_HPP_ff
+
+/*
+Files mapped in memory, used by mainff (through utility_ff.hpp) and by the tools extract, bench_codec and bench_read,
+that do not need the state of the engine.
+*/
+
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstdio>
+
+static int  QUITE_MODE = 1;                     // 0 silent, 1 only errors, 2 everything
+
+
+// map the file pointed by filepath in memory
+// if size is zero, it looks for file size
+// if everything is ok, it returns the memory pointer ptr
+static inline bool mapFile(const char fname[], size_t &size, unsigned char *&ptr) {
+    // open input file.
+    int fd = open(fname,O_RDONLY);
+    if (fd<0) {
+	if (QUITE_MODE>=1) {
+	    perror("mapFile open");
+	    std::fprintf(stderr, "Failed opening file %s\n", fname);
+	}
+	return false;
+    }
+    if (size==0) {
+	struct stat s;
+	if (fstat (fd, &s)) {
+	    if (QUITE_MODE>=1) {
+		perror("fstat");
+		std::fprintf(stderr, "Failed to stat file %s\n", fname);
+	    }
+	    return false;
+	}
+	size=s.st_size;
+    }
+
+    // map all the file in memory
+    ptr = (unsigned char *) mmap (0, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (ptr == MAP_FAILED) {
+	if (QUITE_MODE>=1) {
+	    perror("mmap");
+	    std::fprintf(stderr, "Failed to memory map file %s\n", fname);
+	}
+	return false;
+    }
+    close(fd);
+    return true;
+}
+
+
+// unmap a previously memory-mapped file
+static inline void unmapFile(unsigned char *ptr, size_t size) {
+    if (munmap(ptr, size)<0) {
+	if (QUITE_MODE>=1) {
+	    perror("nummap");
+	    std::fprintf(stderr, "Failed to unmap file\n");
+	}
+    }
+}
+
+// create the output file fname of the given size and map it in memory (shared and writable),
+// so that its content can be written directly through ptr
+// if everything is ok, it returns the memory pointer ptr
+static inline bool mapOutFile(const char fname[], size_t size, unsigned char *&ptr) {
+    int fd = open(fname, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd<0) {
+	if (QUITE_MODE>=1) {
+	    perror("mapOutFile open");
+	    std::fprintf(stderr, "Failed opening file %s\n", fname);
+	}
+	return false;
+    }
+    // reserve the space on disk (when possible), then set the final size
+#if defined(__linux__)
+    posix_fallocate(fd, 0, size);
+#endif
+    if (ftruncate(fd, size)<0) {
+	if (QUITE_MODE>=1) {
+	    perror("ftruncate");
+	    std::fprintf(stderr, "Failed to resize file %s\n", fname);
+	}
+	close(fd);
+	unlink(fname);
+	return false;
+    }
+    ptr = (unsigned char *) mmap (0, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (ptr == MAP_FAILED) {
+	if (QUITE_MODE>=1) {
+	    perror("mmap");
+	    std::fprintf(stderr, "Failed to memory map file %s\n", fname);
+	}
+	close(fd);
+	unlink(fname);
+	return false;
+    }
+    close(fd);
+    return true;
+}
+
+#endif // _MAPPING_HPP_ff
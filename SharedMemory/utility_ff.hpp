@@ -9,248 +9,189 @@ this file was built on top of the utility.hpp file from the ffc folder
 #include <unistd.h>
 #include <cstdlib>
 #include <cstdio>
+#include <cstdint>
 #include <cstring>
+#include <ctime>
 #include <dirent.h> 
 #include <sys/stat.h>
 #include <ftw.h>
 
 #include <algorithm>
+#include <cmath>
 #include <string>
+#include <vector>
 #include <stdexcept>
 
 #include <../miniz/miniz.h>
+#include <../common/filewalker.hpp>
+#include <../common/format.hpp>
+#include <../common/codec.hpp>
+#include <../common/blocksize.hpp>
+#include <mapping_ff.hpp>
 
 
-#define SUFFIX ".zip"
 #define BUF_SIZE (1024 * 1024)
 
 // global variables with their default values ---------------------------------------------------
+// (QUITE_MODE is in mapping_ff.hpp, shared with the tools)
 static bool comp = true;                        // by default, it compresses 
-static size_t BIGFILE_LOW_THRESHOLD = 2097152;  // 2Mbytes threshold
 static bool REMOVE_ORIGIN = false;              // Does it keep the origin file?
-static int  QUITE_MODE = 1;                     // 0 silent, 1 only errors, 2 everything
 static bool RECUR = false;                      // do we have to process the contents of subdirs?
+static int  FORMAT = 2;                         // container format written when compressing (1, 2 or 3)
+static int  LEVEL = MZ_DEFAULT_LEVEL;           // compression level (0..10)
+static int  STRATEGY = MZ_DEFAULT_STRATEGY;     // deflate strategy (MZ_DEFAULT_STRATEGY, MZ_FILTERED, MZ_HUFFMAN_ONLY, MZ_RLE, MZ_FIXED)
+static bool PROBE = true;                       // store the incompressible blocks as they are (format 2 only)
+static bool VERIFY = false;                     // test mode: decompress and check the blocks, nothing is written
+static bool CHAIN = false;                      // prime each block with the end of the previous one (format 2 or 3)
+static const char *ARCHIVE = nullptr;           // -a: the files become the members of this ZIP archive (blocks as in format 3)
+static bool BATCH = true;                       // compression: pack the "small files" in batch tasks (not in archive mode)
+#define BATCH_FILES 64                          // "small files" in a batch: at most BATCH_FILES files and about a block of data
+static size_t READ_THRESHOLD = 64 * 1024;       // -i: files up to this size are read with pread into pooled buffers, not mapped (0: all mapped)
+static long PREFETCH = 4;                       // -p: blocks of a file read ahead of the R-Workers with madvise (0: no hints at all)
 // ----------------------------------------------------------------------------------------------
 
 
-// check if the string 's' is a number, otherwise it returns false
-static bool isNumber(const char* s, long &n) {
-    try {
-		size_t e;
-		n=std::stol(s, &e, 10);
-		return e == strlen(s);
-    } catch (const std::invalid_argument&) {
-		return false;
-    } catch (const std::out_of_range&) {
-		return false;
-    }
+// suffix of the files written when compressing (in archive mode the .zip files are skipped as usual)
+static inline const char *outSuffix() {
+    return (FORMAT == 3 && !ARCHIVE) ? GZ_SUFFIX : SUFFIX;
+}
+
+// true if the block looks incompressible and has to be stored as it is (format 2 only)
+static inline bool incompressible(const unsigned char *ptr, size_t size) {
+    return PROBE && FORMAT == 2 && LEVEL > 0 && sampleEntropy(ptr, size) > ENTROPY_THRESHOLD;
 }
 
 
-// If compdecomp is true (we are compressing), it checks if fname has the suffix SUFFIX,
+// If compdecomp is true (we are compressing), it checks if fname has the suffix outSuffix(),
 // if yes it returns true
 // If compdecomp is false (we are decompressing), it checks if fname has the suffix SUFFIX,
 // if yes it returns false
 static inline bool discardIt(const char *fname, const bool compdecomp) {
-    const int lensuffix=strlen(SUFFIX);
+    const char *suffix = compdecomp ? outSuffix() : SUFFIX;
+    const int lensuffix=strlen(suffix);
     const int len      = strlen(fname);
     if (len>lensuffix &&
-		(strncmp(&fname[len-lensuffix], SUFFIX, lensuffix)==0)) {
+		(strncmp(&fname[len-lensuffix], suffix, lensuffix)==0)) {
 		return compdecomp; // true or false depends on we are compressing or decompressing;
     }
     return !compdecomp;
 }
 
 
-// map the file pointed by filepath in memory
-// if size is zero, it looks for file size
-// if everything is ok, it returns the memory pointer ptr
-static inline bool mapFile(const char fname[], size_t &size, unsigned char *&ptr) {
-    // open input file.
-    int fd = open(fname,O_RDONLY);
-    if (fd<0) {
-	if (QUITE_MODE>=1) {
-	    perror("mapFile open");
-	    std::fprintf(stderr, "Failed opening file %s\n", fname);
-	}
-	return false;
-    }
-    if (size==0) {
-	struct stat s;
-	if (fstat (fd, &s)) {
-	    if (QUITE_MODE>=1) {
-		perror("fstat");
-		std::fprintf(stderr, "Failed to stat file %s\n", fname);
-	    }
-	    return false;
-	}
-	size=s.st_size;
-    }
+// hints on the mapped input files (-p), so that the R-Workers do not wait for the disk --------------------------------
+// madvise works on whole pages: the advice is given for the pages that overlap [ptr, ptr + len)
+static inline void adviseRange(const unsigned char *ptr, size_t len, int advice) {
+    if (PREFETCH == 0 || len == 0) return;
+    const uintptr_t mask = sysconf(_SC_PAGESIZE) - 1;
+    const uintptr_t start = (uintptr_t)ptr & ~mask;
+    madvise((void *)start, (uintptr_t)ptr + len - start, advice);
+}
 
-    // map all the file in memory
-    ptr = (unsigned char *) mmap (0, size, PROT_READ, MAP_PRIVATE, fd, 0);
-    if (ptr == MAP_FAILED) {
-	if (QUITE_MODE>=1) {
-	    perror("mmap");
-	    std::fprintf(stderr, "Failed to memory map file %s\n", fname);
-	}
-	return false;
-    }
-    close(fd);
-    return true;
+// the kernel starts reading [ptr, ptr + len) in the background
+static inline void prefetch(const unsigned char *ptr, size_t len) {
+    adviseRange(ptr, len, MADV_WILLNEED);
+}
+
+// the pages entirely inside [ptr, ptr + len) have been consumed but the file stays mapped (chained blocks, decompression):
+// they leave the address space now and not at munmap. They are still in the page cache, a block that reads them
+// again (as dictionary) just faults them back in
+static inline void dropPages(const unsigned char *ptr, size_t len) {
+    if (PREFETCH == 0) return;
+    const uintptr_t mask = sysconf(_SC_PAGESIZE) - 1;
+    const uintptr_t start = ((uintptr_t)ptr + mask) & ~mask;
+    const uintptr_t end = ((uintptr_t)ptr + len) & ~mask;
+    if (start < end) madvise((void *)start, end - start, MADV_DONTNEED);
 }
 
 
-// unmap a previously memory-mapped file
-static inline void unmapFile(unsigned char *ptr, size_t size) {
-    if (munmap(ptr, size)<0) {
-	if (QUITE_MODE>=1) {
-	    perror("nummap");
-	    std::fprintf(stderr, "Failed to unmap file\n");
-	}
+// write the block index and the trailer of a format 2 file at the given offset
+static inline bool writeIndex(int fd, size_t offset, const std::vector<BlockIndex> &index) {
+    const size_t indexSize = index.size() * sizeof(BlockIndex);
+    Trailer t = makeTrailer(index.size());
+    if (pwrite(fd, index.data(), indexSize, offset) != (ssize_t)indexSize ||
+        pwrite(fd, &t, sizeof(t), offset + indexSize) != (ssize_t)sizeof(t)) {
+	if (QUITE_MODE>=1) perror("pwrite");
+	return false;
     }
+    return true;
 }
 
-
 /*------------------------------------------------------------------------------------------------------------------------------------------------
 Added by me 
 ------------------------------------------------------------------------------------------------------------------------------------------------*/
 
-// Function to get files in a directory sorted by size (recursively or not, depending on RECUR flag)
-std::vector<std::pair<std::string, long>> getSortedFilesInDir(const std::string &dirPath, bool RECUR) {
-    std::vector<std::pair<std::string, long>> filesWithSizes;
-    DIR *dir = opendir(dirPath.c_str());
-
-    if (!dir) {
-        std::cerr << "Error opening directory: " << dirPath << std::endl;
-        return filesWithSizes; // Return an empty list on failure
-    }
-
-    struct dirent *entry;
-    while ((entry = readdir(dir)) != nullptr) {
-        std::string fileName = entry->d_name;
-        std::string fullPath = dirPath + "/" + fileName;
-
-        // Skip "." and ".." directories
-        if (fileName == "." || fileName == "..") {
-            continue;
-        }
-
-        // Skip ".DS_Store" files
-        if (fileName == ".DS_Store") {
-            continue;
-        }
-
-        struct stat statbuf;
-        if (stat(fullPath.c_str(), &statbuf) == -1) {
-            continue; // Skip if stat fails
-        }
-
-        if (S_ISDIR(statbuf.st_mode)) {
-            // If it's a directory and RECUR is true, recurse into the directory
-            if (RECUR) {
-                std::vector<std::pair<std::string, long>> subdirFiles = getSortedFilesInDir(fullPath, RECUR);
-                filesWithSizes.insert(filesWithSizes.end(), subdirFiles.begin(), subdirFiles.end());
-            }
-        } else {
-            // It's a file, add it to the list with its size
-            filesWithSizes.emplace_back(fullPath, statbuf.st_size);
-        }
-    }
-
-    closedir(dir); // Close the directory after processing
-
-    // Sort the files by size: DESCENDING order (largest files first)
-    std::sort(filesWithSizes.begin(), filesWithSizes.end(), [](const std::pair<std::string, long> &a, const std::pair<std::string, long> &b) {
-        return a.second > b.second;
-    });
-
-    return filesWithSizes;
-}
-
-
-// Function to process a file without reading it (check suffix, size, and assign to a partition)
-void processFile(const std::string &filePath, std::vector<std::vector<std::string>> &partitions, std::vector<long> &partitionSizes) {
-    struct stat statbuf; // retrieves metadata about a file, including its size, without reading the file's content
-
-    if (stat(filePath.c_str(), &statbuf) == -1) {
-        return; // Skip if stat fails
-    }
-
+// Function to check a file without reading it (size and suffix), given its size: if it has to be processed it returns true
+static bool acceptFile(const std::string &filePath, long size) {
     //print the stat 
     if (QUITE_MODE >= 2) {
-        std::fprintf(stderr, "statbuf.st_size of file %s is %lld\n", filePath.c_str(), statbuf.st_size);
+        std::fprintf(stderr, "statbuf.st_size of file %s is %ld\n", filePath.c_str(), size);
     }
 
     // Check file size is non-zero
-    if (statbuf.st_size == 0) {
+    if (size == 0) {
         if (QUITE_MODE >= 2) {
             std::fprintf(stderr, "%s has size 0 -- ignored\n", filePath.c_str());
         }
-        return;
+        return false;
     }
 
     // Check file suffix and discard if necessary
     if (comp && discardIt(filePath.c_str(), true)) {
         if (QUITE_MODE >= 2) {
-            std::fprintf(stderr, "%s has already a %s suffix -- ignored\n", filePath.c_str(), SUFFIX);
+            std::fprintf(stderr, "%s has already a %s suffix -- ignored\n", filePath.c_str(), outSuffix());
         }
-        return;
+        return false;
     }
 
     if (!comp && discardIt(filePath.c_str(), false)) {
         if (QUITE_MODE >= 2) {
             std::fprintf(stderr, "%s does not have a %s suffix -- ignored\n", filePath.c_str(), SUFFIX);
         }
-        return;
+        return false;
     }
 
-    // Find the partition with the smallest accumulated size
-    auto min_partition = std::min_element(partitionSizes.begin(), partitionSizes.end());
-    int partitionIndex = std::distance(partitionSizes.begin(), min_partition);
+    return true;
+}
 
-    // Assign the file to that partition
-    partitions[partitionIndex].push_back(filePath);
 
-    // Update the size of the selected partition
-    *min_partition += statbuf.st_size;
+// Function to get all the files to process with their sizes (largest first within the look-ahead window of FileWalker)
+static inline std::vector<std::pair<std::string, long>> getInputFiles(long start, char *argv[], int argc) {
+    std::vector<std::pair<std::string, long>> inputFiles;
+    FileWalker walker(start, argv, argc, acceptFile, RECUR, QUITE_MODE);
+    std::string file;
+    long size = 0;
+    while (walker.next(file, size)) inputFiles.emplace_back(file, size);
+    return inputFiles;
 }
 
 
-// Distribute the workload among n workers
-static std::vector<std::vector<std::string>> partitionInput(long start, char *argv[], int argc, int n) {
+// Distribute the workload among n workers (static scheduling), the files keep their sizes
+static inline std::vector<std::vector<std::pair<std::string, long>>> partitionInput(const std::vector<std::pair<std::string, long>> &inputFiles, int n) {
 	// initialize n partitions
-	std::vector<std::vector<std::string>> partitions(n);
-	// number of files in each partition
+	std::vector<std::vector<std::pair<std::string, long>>> partitions(n);
+	// number of bytes in each partition
 	std::vector<long> partitionSizes(n, 0);
 
-	for(long i = start; i < argc; ++i) {		
-		struct stat statbuf; // retrieves metadata about a file, including its size, without reading the file's content
-
-        if (stat(argv[i], &statbuf) == -1) {
-            std::perror("stat failed");
-            continue; 
-        }
+    for (const auto &[file, size] : inputFiles) {
+        // Find the partition with the smallest accumulated size
+        auto min_partition = std::min_element(partitionSizes.begin(), partitionSizes.end());
+        int partitionIndex = std::distance(partitionSizes.begin(), min_partition);
 
-		// Check if it is a directory
-		if (S_ISDIR(statbuf.st_mode)) {
-            if (QUITE_MODE >= 2) {
-                std::fprintf(stderr, "%s is a directory\n", argv[i]);
-            }
+        // Assign the file to that partition
+        partitions[partitionIndex].emplace_back(file, size);
 
-			// Get all the files in the dir (depending on RECUR, get also the files in the subdirs)
-			std::vector<std::pair<std::string, long>> files = getSortedFilesInDir(argv[i], RECUR);
+        // Update the size of the selected partition
+        *min_partition += size;
+    }
 
-			// Process these files
-            for (const auto &[file, size] : files) {
-                processFile(file, partitions, partitionSizes); 
-            }
+	return partitions;
+}
 
-            continue;
-		} else { // argv[i] is a file
-		    processFile(argv[i], partitions, partitionSizes);
-        }
-	}
 
-	return partitions;
-}
\ No newline at end of file
+// Get all the files to process with their sizes, largest first: they are claimed by the L-Workers at run time (dynamic scheduling)
+static inline std::vector<std::pair<std::string, long>> queueInput(std::vector<std::pair<std::string, long>> inputFiles) {
+    std::stable_sort(inputFiles.begin(), inputFiles.end(), [](const std::pair<std::string, long> &a, const std::pair<std::string, long> &b) {
+        return a.second > b.second;
+    });
+    return inputFiles;
+}
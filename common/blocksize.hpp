@@ -0,0 +1,87 @@
+#if !defined _BLOCKSIZE_HPP
+#define _BLOCKSIZE_HPP
+
+/*
+Size of the blocks in which the "BIG files" are split, shared by mainff and mainmpi (-t).
+*/
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <string>
+
+#include <../common/number.hpp>
+
+
+#define DEFAULT_BLOCK_SIZE 2097152               // 2Mbytes
+#define MIN_BLOCK_SIZE (256 * 1024)             // smallest block accepted (-t with K suffix, or automatic)
+#define MAX_BLOCK_SIZE (100 * 1024 * 1024)      // largest block accepted
+#define BLOCK_ALIGN    (64 * 1024)              // block sizes are multiple of it (blocks start page aligned)
+
+static size_t BIGFILE_LOW_THRESHOLD = DEFAULT_BLOCK_SIZE; // 2Mbytes threshold
+static int  AUTO_BLOCK = 0;                     // block size: 0 fixed (-t), 1 chosen per run, 2 per run and per file
+static size_t MEMORY_BUDGET = 0;                // bytes the blocks in flight may use (-M of mainff, 0: half of the available memory)
+
+// Memory that the blocks in flight may use: MEMORY_BUDGET if set, otherwise half of the available memory
+static size_t memoryBudget() {
+    if (MEMORY_BUDGET > 0) return MEMORY_BUDGET;
+    const long pagesize = sysconf(_SC_PAGESIZE);
+#if defined(_SC_AVPHYS_PAGES)
+    const long pages = sysconf(_SC_AVPHYS_PAGES);
+#else
+    const long pages = sysconf(_SC_PHYS_PAGES);
+#endif
+    if (pages <= 0 || pagesize <= 0) return MAX_BLOCK_SIZE;
+    return (size_t)pages * pagesize / 2;
+}
+
+// round a block size down to BLOCK_ALIGN, within [MIN_BLOCK_SIZE, MAX_BLOCK_SIZE]
+static inline size_t roundBlockSize(size_t bs) {
+    bs -= bs % BLOCK_ALIGN;
+    return std::min(std::max(bs, (size_t)MIN_BLOCK_SIZE), (size_t)MAX_BLOCK_SIZE);
+}
+
+// Choose the block size of a run from the input (total bytes and #files) and the #threads compressing the blocks
+// (the R-Workers of mainff, the threads of all the workers of mainmpi)
+static inline size_t autoBlockSize(size_t totalBytes, size_t nfiles, size_t nworkers) {
+    nworkers = std::max(nworkers, (size_t)1);
+    // about 4 blocks per worker, so that the last blocks do not leave the workers idle
+    size_t bs = totalBytes / (4 * nworkers);
+    // with many files the workers are kept busy by the files: no need for small blocks
+    if (nfiles >= 4 * nworkers) bs = std::max(bs, (size_t)DEFAULT_BLOCK_SIZE);
+    // every worker holds about 4 blocks (input and output, the current one and the next one)
+    bs = std::min(bs, memoryBudget() / (4 * nworkers));
+    return roundBlockSize(bs);
+}
+
+// Block size of a file: BIGFILE_LOW_THRESHOLD, or in per-file mode (-t file) the size that lets the file alone keep
+// all the workers busy (never larger than BIGFILE_LOW_THRESHOLD)
+static inline size_t fileBlockSize(size_t fileSize, size_t nworkers) {
+    if (AUTO_BLOCK != 2) return BIGFILE_LOW_THRESHOLD;
+    nworkers = std::max(nworkers, (size_t)1);
+    return std::min(BIGFILE_LOW_THRESHOLD, roundBlockSize((fileSize + nworkers - 1) / nworkers));
+}
+
+// parse the argument of -t: "auto", "file", a size in Mbyte (min. 2), or a size in Kbyte with a K suffix (min. 256K)
+// it returns false if the argument is not valid
+static inline bool parseBlockSize(const char *arg) {
+    std::string s(arg);
+    if (s == "auto" || s == "file") {
+        AUTO_BLOCK = (s == "auto") ? 1 : 2;
+        return true;
+    }
+    long t = 0;
+    if (!s.empty() && (s.back() == 'K' || s.back() == 'k')) {
+        s.pop_back();
+        if (!isNumber(s.c_str(), t)) return false;
+        BIGFILE_LOW_THRESHOLD = roundBlockSize(t * 1024);
+    } else {
+        if (!isNumber(s.c_str(), t)) return false;
+        t = std::max(2l, t); // min threshold accepted is 2MB (2l = 2 long)
+        BIGFILE_LOW_THRESHOLD = t * (1024 * 1024); // convert to bytes
+    }
+    AUTO_BLOCK = 0;
+    return true;
+}
+
+#endif // _BLOCKSIZE_HPP
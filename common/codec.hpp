@@ -0,0 +1,142 @@
+#if !defined _CODEC_HPP
+#define _CODEC_HPP
+
+/*
+Block codec shared by the engines: a block compressed by one engine is decompressed by the other, so both use
+this Codec (and the same priming of the chained blocks).
+*/
+
+#include <cmath>
+#include <cstring>
+
+#include <algorithm>
+
+#include <../miniz/miniz.h>
+#include <../common/format.hpp>
+
+
+// incompressible blocks --------------------------------------------------------------------------
+#define ENTROPY_THRESHOLD 7.9                   // bits per byte above which a block is considered incompressible
+#define PROBE_CHUNK 4096                        // the entropy is estimated on PROBE_CHUNKS chunks of PROBE_CHUNK bytes
+#define PROBE_CHUNKS 16
+
+// estimate the entropy (in bits per byte) of a block from some chunks spread over it
+static inline double sampleEntropy(const unsigned char *ptr, size_t size) {
+    size_t count[256] = {0};
+    size_t total = 0;
+    const size_t stride = std::max(size / PROBE_CHUNKS, (size_t)PROBE_CHUNK);
+    for (size_t start = 0; start < size; start += stride) {
+        const size_t end = std::min(start + PROBE_CHUNK, size);
+        for (size_t i = start; i < end; ++i) ++count[ptr[i]];
+        total += end - start;
+    }
+    double h = 0.0;
+    for (size_t c : count) {
+        if (c == 0) continue;
+        const double p = (double)c / total;
+        h -= p * std::log2(p);
+    }
+    return h;
+}
+
+// Compressor and decompressor contexts owned by a worker and reset for every block.
+// compress()/uncompress() (and tdefl_compress_mem_to_mem) allocate and initialize a new
+// deflate/inflate state (~300 KB for the compressor) at each call, here it is done once.
+// Both work in one shot on whole blocks and read/write zlib streams (as compress()/uncompress()).
+struct Codec {
+    explicit Codec(int level = MZ_DEFAULT_LEVEL, int strategy = MZ_DEFAULT_STRATEGY):
+        level(level), strategy(strategy), deflator(new tdefl_compressor) {}
+    ~Codec() { delete deflator; }
+    Codec(const Codec &) = delete;
+    Codec &operator=(const Codec &) = delete;
+
+    // compress with level and strategy, using the dict bytes just before `in` as preset dictionary
+    // on input outLen is the size of the output buffer, on output the compressed size
+    bool compress(unsigned char *out, unsigned long *outLen, const unsigned char *in, size_t inLen, size_t dict = 0) {
+        const mz_uint flags = tdefl_create_comp_flags_from_zip_params(level, MZ_DEFAULT_WINDOW_BITS, strategy);
+        if (tdefl_init(deflator, nullptr, nullptr, flags) != TDEFL_STATUS_OKAY) return false;
+        if (dict) prime(in - dict, dict, flags);
+        size_t in_bytes = inLen, out_bytes = *outLen;
+        if (tdefl_compress(deflator, in, &in_bytes, out, &out_bytes, TDEFL_FINISH) != TDEFL_STATUS_DONE) return false;
+        *outLen = out_bytes;
+        return true;
+    }
+
+    // compress into raw deflate data that can be appended to the previous blocks of a gzip member (format 3):
+    // a block ends with a sync flush (an empty stored block, so the next one starts byte aligned),
+    // the last block of the file with the final deflate block
+    bool compressRaw(unsigned char *out, unsigned long *outLen, const unsigned char *in, size_t inLen, bool last, size_t dict = 0) {
+        const mz_uint flags = tdefl_create_comp_flags_from_zip_params(level, -MZ_DEFAULT_WINDOW_BITS, strategy);
+        if (tdefl_init(deflator, nullptr, nullptr, flags) != TDEFL_STATUS_OKAY) return false;
+        if (dict) prime(in - dict, dict, flags);
+        size_t in_bytes = inLen, out_bytes = *outLen;
+        const tdefl_status status = tdefl_compress(deflator, in, &in_bytes, out, &out_bytes, last ? TDEFL_FINISH : TDEFL_SYNC_FLUSH);
+        // everything has to be consumed and flushed in one call (out has compressBound bytes)
+        if (status != (last ? TDEFL_STATUS_DONE : TDEFL_STATUS_OKAY) || in_bytes != inLen || deflator->m_output_flush_remaining) return false;
+        *outLen = out_bytes;
+        return true;
+    }
+
+    // decompress, the dict bytes just before `out` must hold the preset dictionary used to compress
+    // on input outLen is the size of the output buffer, on output the decompressed size
+    bool uncompress(unsigned char *out, size_t *outLen, const unsigned char *in, size_t inLen, size_t dict = 0) {
+        tinfl_init(&inflator);
+        size_t in_bytes = inLen, out_bytes = *outLen;
+        const mz_uint32 flags = TINFL_FLAG_PARSE_ZLIB_HEADER | TINFL_FLAG_COMPUTE_ADLER32 | TINFL_FLAG_USING_NON_WRAPPING_OUTPUT_BUF;
+        // the output buffer starts at the dictionary, so the matches can reach back into it
+        if (tinfl_decompress(&inflator, in, &in_bytes, out - dict, out, &out_bytes, flags) != TINFL_STATUS_DONE) return false;
+        *outLen = out_bytes;
+        return true;
+    }
+
+    // load a preset dictionary into the compressor just initialized, as if it had already compressed it
+    // (miniz has no deflateSetDictionary): window, hash chains and positions as tdefl_compress leaves them.
+    // It writes private fields of tdefl_compressor and repeats the hashing of tdefl_compress, checked against
+    // miniz 10.1.0 (miniz/ in this tree): a different miniz has to be checked again (common/test_codec.cpp)
+    static_assert(MZ_VERNUM == 0xA100, "Codec::prime depends on the internals of miniz 10.1.0");
+    void prime(const unsigned char *dict, size_t len, mz_uint flags) {
+        tdefl_compressor *d = deflator;
+        len = std::min(len, (size_t)TDEFL_LZ_DICT_SIZE);
+        std::memcpy(d->m_dict, dict, len);
+        std::memcpy(d->m_dict + TDEFL_LZ_DICT_SIZE, dict, std::min(len, (size_t)TDEFL_MAX_MATCH_LEN - 1));
+
+        // same condition used by tdefl_compress to pick the fast (level 1) parser, that has its own hash
+        bool fast = false;
+#if MINIZ_USE_UNALIGNED_LOADS_AND_STORES && MINIZ_LITTLE_ENDIAN
+        fast = ((flags & TDEFL_MAX_PROBES_MASK) == 1) && (flags & TDEFL_GREEDY_PARSING_FLAG) &&
+               !(flags & (TDEFL_FILTER_MATCHES | TDEFL_FORCE_ALL_RAW_BLOCKS | TDEFL_RLE_MATCHES));
+#endif
+        for (size_t pos = 0; pos + 2 < len; ++pos) {
+            const mz_uint c0 = d->m_dict[pos], c1 = d->m_dict[pos + 1], c2 = d->m_dict[pos + 2];
+            if (fast) {
+                const mz_uint trigram = c0 | (c1 << 8) | (c2 << 16);
+                d->m_hash[(trigram ^ (trigram >> (24 - (TDEFL_LZ_HASH_BITS - 8)))) & TDEFL_LEVEL1_HASH_SIZE_MASK] = (mz_uint16)pos;
+            } else {
+                const mz_uint hash = ((c0 << (2 * TDEFL_LZ_HASH_SHIFT)) ^ (c1 << TDEFL_LZ_HASH_SHIFT) ^ c2) & (TDEFL_LZ_HASH_SIZE - 1);
+                d->m_next[pos & TDEFL_LZ_DICT_SIZE_MASK] = d->m_hash[hash];
+                d->m_hash[hash] = (mz_uint16)pos;
+            }
+        }
+        d->m_lookahead_pos = d->m_dict_size = d->m_lz_code_buf_dict_pos = (mz_uint)len;
+    }
+
+    const int level;                    // compression level (0..10) and deflate strategy
+    const int strategy;
+    tdefl_compressor *deflator;         // too big for the stack of a thread
+    tinfl_decompressor inflator;
+};
+
+// decompress the block described by b, read from in (its cmp_size bytes), into out (room for its size bytes)
+// a chained block needs its dict bytes of dictionary just before out; the CRC32 is checked if the index has it
+static inline bool decodeBlock(Codec &codec, const BlockIndex &b, const unsigned char *in, unsigned char *out, size_t dict = 0) {
+    if (b.flags & BLOCK_STORED) {
+        if (b.size != b.cmp_size) return false;
+        std::memcpy(out, in, b.size);
+    } else {
+        size_t out_size = b.size;
+        if (!codec.uncompress(out, &out_size, in, b.cmp_size, dict) || out_size != b.size) return false;
+    }
+    return !(b.flags & BLOCK_CRC) || blockCrc(out, b.size) == b.crc;
+}
+
+#endif // _CODEC_HPP
@@ -0,0 +1,213 @@
+#if !defined _FILEWALKER_HPP
+#define _FILEWALKER_HPP
+
+/*
+Enumeration of the input files, shared by the three engines (Sequential, SharedMemory and Distributed).
+*/
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <queue>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+// Parallel and streaming enumeration of the input: the files and the directories of the command line (the
+// subdirectories only if recur) are walked by WALK_THREADS threads while the files found are taken with next(),
+// so they are processed while the rest of the tree is still being walked. Only the files for which accept(path, size)
+// is true are returned: each engine passes its own check (size, suffix).
+// The walker keeps a look-ahead window of up to LOOKAHEAD files and returns the largest one in it (the walk pauses
+// when the window is full). next() does not wait for a full window: it returns as soon as the files of the chunks
+// being read are in, or the window has `want` files, that starts at 1 and doubles at each file up to LOOKAHEAD. So the
+// first files are returned at once, and the order gets closer to largest first over the whole input as the walk goes on.
+// The directories are read through their descriptor: the entries are stat-ed relative to it (fstatat, no path to
+// resolve again from the root), and the type in the entry saves the stat of the subdirectories and of the special
+// files. A directory is read WALK_CHUNK entries at a time, so a large one is shared among the threads as well.
+// The messages follow the QUITE_MODE of the engines (quite: 0 silent, 1 only errors, 2 everything), the errors are
+// counted in `errors` anyway.
+#define LOOKAHEAD 1024
+#define WALK_THREADS 4                          // threads that read the directories (they mostly wait for the file system)
+#define WALK_CHUNK 256                          // entries read from a directory by a thread before it is given back
+class FileWalker {
+public:
+    using Accept = std::function<bool(const std::string &file, long size)>;
+
+    FileWalker(long start, char *argv[], int argc, Accept check, bool recur, int quite = 1, int nthreads = WALK_THREADS):
+        accept(std::move(check)), recur(recur), quite(quite) {
+        for (long i = start; i < argc; ++i) {
+            struct stat statbuf; // retrieves metadata about a file, including its size, without reading the file's content
+            if (stat(argv[i], &statbuf) == -1) {
+                if (quite >= 1) {
+                    std::perror("stat failed");
+                    std::fprintf(stderr, "Error: stat %s\n", argv[i]);
+                }
+                ++errors;
+                continue;
+            }
+            if (S_ISDIR(statbuf.st_mode)) {
+                if (quite >= 2) {
+                    std::fprintf(stderr, "%s is a directory\n", argv[i]);
+                }
+                pending.push_back({argv[i], nullptr}); // the files in it are always processed, its subdirs only if recur
+            } else if (accept(argv[i], statbuf.st_size)) {
+                window.push({argv[i], (long)statbuf.st_size, seq++});
+            }
+        }
+        for (int i = 0; i < nthreads; ++i) threads.emplace_back([this] { walk(); });
+    }
+    ~FileWalker() {
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            stop = true;
+        }
+        room.notify_all();
+        for (auto &t : threads) t.join();
+        for (auto &d : pending) if (d.dir) closedir(d.dir);
+    }
+
+    // next file to process with its size, false when the walk is over
+    bool next(std::string &file, long &size) {
+        std::unique_lock<std::mutex> lock(mtx);
+        ready.wait(lock, [this] { return window.size() >= want || (!window.empty() && busy == 0) || finished(); });
+        if (window.empty()) return false;
+        file = window.top().file;
+        size = window.top().size;
+        window.pop();
+        want = std::min(2 * want, (size_t)LOOKAHEAD);
+        lock.unlock();
+        room.notify_one();
+        return true;
+    }
+
+    std::atomic<size_t> errors{0};                      // arguments, directories or entries that could not be read
+
+private:
+    struct Entry {
+        std::string file;
+        long size;
+        size_t seq;     // walk order, for the ties
+        bool operator<(const Entry &e) const { return size < e.size || (size == e.size && seq > e.seq); }
+    };
+    struct Dir {
+        std::string path;
+        DIR *dir;       // nullptr until it is opened, then kept open until it is read completely
+    };
+
+    bool finished() const { return pending.empty() && busy == 0; }
+
+    // body of the walker threads: take a directory, read a chunk of it, publish what was found
+    void walk() {
+        std::unique_lock<std::mutex> lock(mtx);
+        while (true) {
+            room.wait(lock, [this] { return stop || finished() || (!pending.empty() && window.size() < LOOKAHEAD); });
+            if (stop || finished()) break;
+            Dir d = pending.back();
+            pending.pop_back();
+            ++busy;
+            lock.unlock();
+
+            std::vector<Dir> subdirs;
+            std::vector<std::pair<std::string, long>> files;
+            const bool more = readChunk(d, subdirs, files);
+
+            lock.lock();
+            for (auto &[file, size] : files) window.push({std::move(file), size, seq++});
+            pending.insert(pending.end(), subdirs.begin(), subdirs.end());
+            if (more) pending.push_back(d); // the rest of the directory is read next, so few directories are open at a time
+            --busy;
+            ready.notify_all();
+            room.notify_all();
+        }
+        ready.notify_all();
+    }
+
+    // read up to WALK_CHUNK entries of d, it returns false when d has been read completely (or it cannot be read)
+    bool readChunk(Dir &d, std::vector<Dir> &subdirs, std::vector<std::pair<std::string, long>> &files) {
+        if (!d.dir) {
+            const int fd = open(d.path.c_str(), O_RDONLY | O_DIRECTORY);
+            if (fd == -1 || !(d.dir = fdopendir(fd))) {
+                if (fd != -1) close(fd);
+                if (quite >= 1) std::cerr << "Error opening directory: " << d.path << std::endl;
+                ++errors;
+                return false;
+            }
+        }
+        const int fd = dirfd(d.dir);
+        for (int n = 0; n < WALK_CHUNK; ++n) {
+            errno = 0;
+            struct dirent *entry = readdir(d.dir);
+            if (!entry) {
+                if (errno != 0) {
+                    if (quite >= 1) {
+                        std::perror("readdir");
+                        std::cerr << "Error reading directory: " << d.path << std::endl;
+                    }
+                    ++errors;
+                }
+                closedir(d.dir); // Close the directory after processing
+                d.dir = nullptr;
+                return false;
+            }
+            const char *name = entry->d_name;
+
+            // Skip "." and "..", and ".DS_Store" files
+            if (!strcmp(name, ".") || !strcmp(name, "..") || !strcmp(name, ".DS_Store")) continue;
+
+            // the size of the regular files is needed, the links (followed as stat does) and the unknown types are resolved
+            bool isDir = (entry->d_type == DT_DIR);
+            long size = 0;
+            if (!isDir) {
+                if (entry->d_type != DT_REG && entry->d_type != DT_LNK && entry->d_type != DT_UNKNOWN) continue; // fifo, socket, device
+                struct stat statbuf;
+                if (fstatat(fd, name, &statbuf, 0) == -1) {
+                    if (quite >= 1) {
+                        std::perror("stat failed");
+                        std::cerr << "Error: stat " << d.path << "/" << name << std::endl;
+                    }
+                    ++errors;
+                    continue;
+                }
+                isDir = S_ISDIR(statbuf.st_mode);
+                size = statbuf.st_size;
+            }
+
+            std::string path = d.path + "/" + name;
+            if (isDir) {
+                if (recur) subdirs.push_back({std::move(path), nullptr});
+            } else if (accept(path, size)) {
+                files.emplace_back(std::move(path), size);
+            }
+        }
+        return true;
+    }
+
+    const Accept accept;                                // the files to return
+    const bool recur;                                   // walk the subdirectories too
+    const int quite;                                    // messages: 0 none, 1 errors, 2 everything
+    std::mutex mtx;
+    std::condition_variable ready;                      // a file in the window, or the walk is over
+    std::condition_variable room;                       // a directory to read and room in the window, or stop
+    std::vector<Dir> pending;                           // directories still to read (completely or in part)
+    std::priority_queue<Entry> window;                  // look-ahead window, largest file on top
+    size_t seq = 0;
+    size_t want = 1;                                    // files in the window before next() returns (busy walkers)
+    int busy = 0;                                       // threads reading a directory
+    bool stop = false;
+    std::vector<std::thread> threads;
+};
+
+#endif // _FILEWALKER_HPP
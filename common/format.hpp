@@ -0,0 +1,239 @@
+#if !defined _FORMAT_HPP
+#define _FORMAT_HPP
+
+/*
+Formats of the compressed files, shared by the engines: a file written by mainff is read by mainmpi and the other
+way around, so there is only one definition of the block index, of the trailer and of the gzip and ZIP records.
+*/
+
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+
+#include <algorithm>
+#include <istream>
+#include <vector>
+
+#include <../miniz/miniz.h>
+
+
+#define SUFFIX ".zip"
+#define GZ_SUFFIX ".gz"                         // format 3 (gzip)
+
+// container formats of the compressed files ----------------------------------------------------
+// - format 1 (header first): [N, size1, cmp_size1, ..., sizeN, cmp_sizeN][block1]...[blockN]
+// - format 2 (trailer index): [blocks, in any order][N x BlockIndex, in block order][Trailer]
+//   the blocks can be written as soon as they are compressed, the index is written at the end
+//   new fields are appended to BlockIndex, the version in the trailer tells the size of the entries
+// - format 3 (gzip, written only): a single gzip member, the blocks are raw deflate streams ended by a sync
+//   flush (the last one by the final deflate block) appended in order, the trailer has the CRC32 of the
+//   whole file combined from the ones of the blocks. Any gzip -d reads it (this program does not, no index)
+#define FORMAT_MAGIC "SPMZIDX"                  // 7 chars + '\0' = 8 bytes
+#define INDEX_VERSION 4                         // 2: size, cmp_size, offset -- 3: + flags -- 4: + crc
+#define BLOCK_STORED 1                          // flag: the block is stored as it is (not compressed)
+#define BLOCK_CRC 2                             // flag: crc holds the CRC32 of the original block
+#define BLOCK_DICT 4                            // flag: the block is primed with the end of the previous one (see dictLen)
+
+struct BlockIndex {
+    size_t size;        // original size of the block
+    size_t cmp_size;    // compressed size of the block
+    size_t offset;      // offset of the compressed block in the file
+    size_t flags = 0;   // BLOCK_STORED, BLOCK_CRC, BLOCK_DICT
+    size_t crc = 0;     // CRC32 of the original block
+};
+
+// size of an entry of the block index written with the given version (0 if the version is not known)
+static inline size_t indexEntrySize(size_t version) {
+    switch (version) {
+        case 2: return 3 * sizeof(size_t);
+        case 3: return 4 * sizeof(size_t);
+        case 4: return sizeof(BlockIndex);
+        default: return 0;
+    }
+}
+
+struct Trailer {
+    size_t nblocks;
+    size_t version;
+    char magic[8];
+};
+
+// build the trailer of a format 2 file
+static inline Trailer makeTrailer(size_t nblocks) {
+    Trailer t;
+    t.nblocks = nblocks;
+    t.version = INDEX_VERSION;
+    std::memcpy(t.magic, FORMAT_MAGIC, sizeof(t.magic));
+    return t;
+}
+
+// read the block index of a compressed file of the given size mapped at ptr, whatever its format
+// it returns false if the file is not a valid compressed file
+static inline bool readIndex(const unsigned char *ptr, size_t size, std::vector<BlockIndex> &index) {
+    index.clear();
+    Trailer t;
+    if (size >= sizeof(Trailer)) {
+	std::memcpy(&t, ptr + size - sizeof(Trailer), sizeof(Trailer));
+    }
+    if (size >= sizeof(Trailer) && std::memcmp(t.magic, FORMAT_MAGIC, sizeof(t.magic)) == 0) {
+	// format 2: the index is just before the trailer
+	const size_t entrySize = indexEntrySize(t.version);
+	if (entrySize == 0 || t.nblocks > (size - sizeof(Trailer)) / entrySize) return false;
+	const size_t indexStart = size - sizeof(Trailer) - t.nblocks * entrySize;
+	index.resize(t.nblocks);
+	for (size_t i = 0; i < t.nblocks; ++i) {
+	    std::memcpy(&index[i], ptr + indexStart + i * entrySize, entrySize); // fields not in the entry stay 0
+	}
+	for (const auto &b : index) {
+	    if (b.offset > indexStart || b.cmp_size > indexStart - b.offset) return false;
+	}
+	return true;
+    }
+    // format 1: [N, size1, cmp_size1, ..., sizeN, cmp_sizeN] followed by the blocks in order
+    if (size < sizeof(size_t)) return false;
+    size_t nblocks;
+    std::memcpy(&nblocks, ptr, sizeof(size_t));
+    if (nblocks > (size - sizeof(size_t)) / (2 * sizeof(size_t))) return false;
+    size_t offset = sizeof(size_t) + nblocks * 2 * sizeof(size_t);
+    index.resize(nblocks);
+    for (size_t i = 0; i < nblocks; ++i) {
+	std::memcpy(&index[i].size, ptr + sizeof(size_t) + i * 2 * sizeof(size_t), sizeof(size_t));
+	std::memcpy(&index[i].cmp_size, ptr + 2 * sizeof(size_t) + i * 2 * sizeof(size_t), sizeof(size_t));
+	index[i].offset = offset;
+	if (index[i].cmp_size > size - offset) return false;
+	offset += index[i].cmp_size;
+    }
+    return true;
+}
+
+// the same, reading the file from a stream (mainmpi does not map the input files)
+static inline bool readIndex(std::istream &inFile, size_t size, std::vector<BlockIndex> &index) {
+    index.clear();
+    Trailer t;
+    if (size >= sizeof(Trailer)) {
+        inFile.seekg(size - sizeof(Trailer));
+        inFile.read(reinterpret_cast<char*>(&t), sizeof(Trailer));
+    }
+    if (size >= sizeof(Trailer) && inFile && std::memcmp(t.magic, FORMAT_MAGIC, sizeof(t.magic)) == 0) {
+        // format 2: the index is just before the trailer
+        const size_t entrySize = indexEntrySize(t.version);
+        if (entrySize == 0 || t.nblocks > (size - sizeof(Trailer)) / entrySize) return false;
+        const size_t indexStart = size - sizeof(Trailer) - t.nblocks * entrySize;
+        index.resize(t.nblocks);
+        inFile.seekg(indexStart);
+        for (size_t i = 0; i < t.nblocks; ++i) {
+            inFile.read(reinterpret_cast<char*>(&index[i]), entrySize); // fields not in the entry stay 0
+        }
+        for (const auto &b : index) {
+            if (b.offset > indexStart || b.cmp_size > indexStart - b.offset) return false;
+        }
+        return bool(inFile);
+    }
+    // format 1: [N, size1, cmp_size1, ..., sizeN, cmp_sizeN] followed by the blocks in order
+    inFile.clear();
+    inFile.seekg(0);
+    size_t nblocks;
+    if (size < sizeof(size_t) || !inFile.read(reinterpret_cast<char*>(&nblocks), sizeof(size_t))) return false;
+    if (nblocks > (size - sizeof(size_t)) / (2 * sizeof(size_t))) return false;
+    size_t offset = sizeof(size_t) + nblocks * 2 * sizeof(size_t);
+    index.resize(nblocks);
+    for (size_t i = 0; i < nblocks; ++i) {
+        inFile.read(reinterpret_cast<char*>(&index[i].size), sizeof(size_t));
+        inFile.read(reinterpret_cast<char*>(&index[i].cmp_size), sizeof(size_t));
+        index[i].offset = offset;
+        if (index[i].cmp_size > size - offset) return false;
+        offset += index[i].cmp_size;
+    }
+    return bool(inFile);
+}
+
+// chained blocks (-d 1) --------------------------------------------------------------------------
+#define DICT_SIZE 32768                         // preset dictionary of a chained block: the deflate window
+
+// size of the preset dictionary of a chained block that starts at `offset` in the original file
+static inline size_t dictLen(size_t offset) {
+    return std::min(offset, (size_t)DICT_SIZE);
+}
+
+// CRC32 ------------------------------------------------------------------------------------------
+// CRC32 of a block of original data
+static inline size_t blockCrc(const unsigned char *ptr, size_t size) {
+    return mz_crc32(MZ_CRC32_INIT, ptr, size);
+}
+
+// CRC32 of the concatenation of two blocks, from their CRC32s and the size of the second one
+// (as crc32_combine of zlib: the CRC register is advanced over len2 zeros by squaring a GF(2) matrix)
+static inline mz_uint32 gf2Times(const mz_uint32 *mat, mz_uint32 vec) {
+    mz_uint32 sum = 0;
+    for (; vec; vec >>= 1, ++mat)
+        if (vec & 1) sum ^= *mat;
+    return sum;
+}
+static inline void gf2Square(mz_uint32 *square, const mz_uint32 *mat) {
+    for (int n = 0; n < 32; ++n) square[n] = gf2Times(mat, mat[n]);
+}
+static inline size_t crc32Combine(size_t crc1, size_t crc2, size_t len2) {
+    if (len2 == 0) return crc1;
+    mz_uint32 even[32], odd[32];               // operators for 2^k and 2^(k+1) zero bits
+    odd[0] = 0xedb88320u;                       // CRC-32 polynomial: operator for one zero bit
+    for (int n = 1; n < 32; ++n) odd[n] = 1u << (n - 1);
+    gf2Square(even, odd);                       // two zero bits
+    gf2Square(odd, even);                       // four zero bits
+    mz_uint32 crc = (mz_uint32)crc1;
+    do {                                        // one zero byte the first time, then doubling
+        gf2Square(even, odd);
+        if (len2 & 1) crc = gf2Times(even, crc);
+        len2 >>= 1;
+        if (!len2) break;
+        gf2Square(odd, even);
+        if (len2 & 1) crc = gf2Times(odd, crc);
+        len2 >>= 1;
+    } while (len2);
+    return crc ^ (mz_uint32)crc2;
+}
+
+// gzip -------------------------------------------------------------------------------------------
+// gzip member (RFC 1952): 10 bytes header (deflate, no name, mtime 0, OS unix), 8 bytes trailer
+#define GZ_HEADER_SIZE 10
+#define GZ_TRAILER_SIZE 8
+static const unsigned char GZ_HEADER[GZ_HEADER_SIZE] = {0x1f, 0x8b, 8, 0, 0, 0, 0, 0, 0, 3};
+
+// gzip trailer: CRC32 and size (mod 2^32) of the original data, little endian
+static inline void gzTrailer(unsigned char *out, size_t crc, size_t size) {
+    for (int i = 0; i < 4; ++i) {
+        out[i]     = (unsigned char)(crc >> (8 * i));
+        out[4 + i] = (unsigned char)(size >> (8 * i));
+    }
+}
+
+// ZIP --------------------------------------------------------------------------------------------
+// ZIP archive (-a of mainff, APPNOTE 4.3): a member is written while its blocks arrive, so its local header has the
+// "data descriptor" flag and the CRC32 and the sizes follow the data. A member that may reach 4 Gbyte has zip64
+// extra fields (and an 8 bytes sizes descriptor), as the end of an archive that is too large for the 32 bits one
+#define ZIP_LOCAL_HEADER_SIZE   30
+#define ZIP_CENTRAL_HEADER_SIZE 46
+#define ZIP_END_SIZE            22
+#define ZIP64_END_SIZE          56
+#define ZIP64_LOCATOR_SIZE      20
+#define ZIP_FLAGS               0x0808          // data descriptor, UTF-8 names
+#define ZIP_MAX32               ((uint64_t)0xFFFFFFFF)
+
+// little endian field of n bytes, it returns the byte after it
+static inline unsigned char *putLE(unsigned char *p, uint64_t v, int n) {
+    for (int i = 0; i < n; ++i) *p++ = (unsigned char)(v >> (8 * i));
+    return p;
+}
+
+// MS-DOS time and date of the members (local time, 1980 at least)
+static inline void dosTime(time_t t, uint16_t &time, uint16_t &date) {
+    struct tm tm;
+    if (!localtime_r(&t, &tm) || tm.tm_year < 80) {
+        time = 0;
+        date = (1 << 5) | 1;
+        return;
+    }
+    time = (uint16_t)((tm.tm_hour << 11) | (tm.tm_min << 5) | (tm.tm_sec >> 1));
+    date = (uint16_t)(((tm.tm_year - 80) << 9) | ((tm.tm_mon + 1) << 5) | tm.tm_mday);
+}
+
+#endif // _FORMAT_HPP
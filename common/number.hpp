@@ -0,0 +1,23 @@
+#if !defined _NUMBER_HPP
+#define _NUMBER_HPP
+
+#include <cstring>
+
+#include <stdexcept>
+#include <string>
+
+
+// check if the string 's' is a number, otherwise it returns false
+static bool isNumber(const char* s, long &n) {
+    try {
+		size_t e;
+		n=std::stol(s, &e, 10);
+		return e == strlen(s);
+    } catch (const std::invalid_argument&) {
+		return false;
+    } catch (const std::out_of_range&) {
+		return false;
+    }
+}
+
+#endif // _NUMBER_HPP
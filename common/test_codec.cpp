@@ -0,0 +1,97 @@
+/*
+Check of Codec::prime against stock zlib: Codec::prime writes private fields of the miniz compressor, so a
+chained block (-d 1) is decoded here by zlib, not by miniz, for the levels that use the fast parser and for
+the others.
+- a zlib block compressed with a preset dictionary is inflated by zlib with inflateSetDictionary, and it has to
+  be smaller than the same block compressed without (the dictionary is used, not just ignored)
+- two raw blocks, the second primed with the first (format 3), are inflated by zlib as one stream
+
+usage: make test (it links the system zlib)
+*/
+
+#define MINIZ_NO_ZLIB_COMPATIBLE_NAMES          // miniz and zlib in the same file
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <vector>
+
+#include <zlib.h>
+#include <../common/codec.hpp>
+
+#define TEST_SIZE (256 * 1024)
+
+// pseudo text with long repeats, so that the second block has matches in the first one
+static std::vector<unsigned char> makeData(size_t size) {
+    static const char *words[] = {"the ", "parallel ", "block ", "of ", "file ", "compression ", "and ", "worker ",
+                                  "a ", "stream ", "data ", "to ", "miniz ", "in ", "with ", "\n"};
+    std::mt19937 gen(7);
+    std::uniform_int_distribution<int> pick(0, 15);
+    std::vector<unsigned char> data;
+    while (data.size() < size) {
+        const char *w = words[pick(gen)];
+        data.insert(data.end(), w, w + std::strlen(w));
+    }
+    data.resize(size);
+    return data;
+}
+
+// inflate raw deflate data with zlib, dict (if any) is set before the first byte
+static bool zInflate(const unsigned char *in, size_t inLen, const unsigned char *dict, size_t dictLen,
+                     unsigned char *out, size_t outLen, size_t &written) {
+    z_stream zs{};
+    if (inflateInit2(&zs, -MAX_WBITS) != Z_OK) return false;
+    zs.next_in = const_cast<unsigned char *>(in);
+    zs.avail_in = (uInt)inLen;
+    zs.next_out = out;
+    zs.avail_out = (uInt)outLen;
+    int ret = dictLen ? inflateSetDictionary(&zs, dict, (uInt)dictLen) : Z_OK;
+    if (ret == Z_OK) ret = inflate(&zs, Z_FINISH);
+    written = zs.total_out;
+    inflateEnd(&zs);
+    return ret == Z_STREAM_END;
+}
+
+// zlib block primed with the dict bytes before it: miniz does not set FDICT, the stream is read by zlib
+// as raw deflate after the 2 bytes header and its Adler-32 is checked apart
+static bool testZlib(Codec &codec, const std::vector<unsigned char> &data, size_t dict) {
+    const size_t len = data.size() - dict;
+    std::vector<unsigned char> cmp(mz_compressBound(len)), out(len);
+    unsigned long cmpLen = cmp.size();
+    if (!codec.compress(cmp.data(), &cmpLen, data.data() + dict, len, dict) || cmpLen < 6) return false;
+    std::vector<unsigned char> plain(cmp.size());
+    unsigned long plainLen = plain.size();
+    if (!codec.compress(plain.data(), &plainLen, data.data() + dict, len) || plainLen <= cmpLen) return false;
+    size_t written = 0;
+    if (!zInflate(cmp.data() + 2, cmpLen - 6, data.data(), dict, out.data(), out.size(), written)) return false;
+    const unsigned char *t = cmp.data() + cmpLen - 4;
+    const uLong sum = ((uLong)t[0] << 24) | ((uLong)t[1] << 16) | ((uLong)t[2] << 8) | t[3];
+    return written == len && std::memcmp(out.data(), data.data() + dict, len) == 0 && sum == adler32(1, out.data(), (uInt)len);
+}
+
+// two raw blocks as in a format 3 file: the second one primed with the end of the first, one stream for zlib
+static bool testRaw(Codec &codec, const std::vector<unsigned char> &data) {
+    const size_t half = data.size() / 2;
+    std::vector<unsigned char> cmp(2 * mz_compressBound(half)), out(data.size());
+    unsigned long first = cmp.size(), second;
+    if (!codec.compressRaw(cmp.data(), &first, data.data(), half, false)) return false;
+    second = cmp.size() - first;
+    if (!codec.compressRaw(cmp.data() + first, &second, data.data() + half, data.size() - half, true, dictLen(half))) return false;
+    size_t written = 0;
+    if (!zInflate(cmp.data(), first + second, nullptr, 0, out.data(), out.size(), written)) return false;
+    return written == data.size() && out == data;
+}
+
+int main() {
+    const std::vector<unsigned char> data = makeData(TEST_SIZE);
+    int failed = 0;
+    for (int level : {1, 6, 9}) {
+        for (int strategy : {MZ_DEFAULT_STRATEGY, MZ_FILTERED}) {
+            Codec codec(level, strategy);
+            const bool zlib = testZlib(codec, data, DICT_SIZE), raw = testRaw(codec, data);
+            std::printf("level %d strategy %d: zlib block with dictionary %s, chained raw blocks %s\n",
+                        level, strategy, zlib ? "ok" : "FAILED", raw ? "ok" : "FAILED");
+            failed += !zlib + !raw;
+        }
+    }
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,23 @@
+#!/bin/bash
+#SBATCH --job-name=Irene                      # Job name
+#SBATCH --output=output_ff_sched_%j.txt       # Standard output and error log
+#SBATCH --nodes=1                             # Run on a single node
+#SBATCH --ntasks=1                            # Number of tasks (processes)
+#SBATCH --time=01:50:00          
+
+# Define the dataset path
+DATASET_PATH="/home/i.dovichi/project/SharedMemory/data_strong4"
+
+
+# Compare static partitioning (-s 0) and dynamic file claiming (-s 1) of the files among the L-Workers
+for i in 0 1 2 3 4; do
+    echo "Run,$i"
+    for s in 0 1; do
+        for l in 1 2 4 7; do
+            for r in 1 2 4 8 16 24 32 40; do
+                echo "Compression,$s,$l,$r,$(/home/i.dovichi/project/SharedMemory/mainff -s $s -l $l -r $r -t 16 -C 1 $DATASET_PATH | grep 'Elapsed time' | awk '{print $3}')"
+                echo "Decompression,$s,$l,$r,$(/home/i.dovichi/project/SharedMemory/mainff -s $s -l $l -r $r -t 16 -D 1 $DATASET_PATH | grep 'Elapsed time' | awk '{print $3}')"
+            done
+        done
+    done
+done
@@ -0,0 +1,24 @@
+#!/bin/bash
+#SBATCH --job-name=Irene                      # Job name
+#SBATCH --output=output_ff_writers_%j.txt     # Standard output and error log
+#SBATCH --nodes=1                             # Run on a single node
+#SBATCH --ntasks=1                            # Number of tasks (processes)
+#SBATCH --time=01:50:00          
+
+# Define the dataset path
+DATASET_PATH="/home/i.dovichi/project/SharedMemory/data_strong4"
+
+
+# Scaling of the Writers (-W) with the R-Workers: formats 1 and 3 send all the blocks of the "BIG files" through the Writers
+# (format 2 does not use them), the decompression is there as a reference
+for i in 0 1 2 3 4; do
+    echo "Run,$i"
+    for f in 1 3; do
+        for w in 1 2 4 8; do
+            for r in 1 2 4 8 16 24 32 40; do
+                echo "Compression,$f,$w,$r,$(/home/i.dovichi/project/SharedMemory/mainff -f $f -W $w -l 2 -r $r -t 16 -C 1 $DATASET_PATH | grep 'Elapsed time' | awk '{print $3}')"
+                echo "Decompression,$f,$w,$r,$(/home/i.dovichi/project/SharedMemory/mainff -W $w -l 2 -r $r -D 1 $DATASET_PATH | grep 'Elapsed time' | awk '{print $3}')"
+            done
+        done
+    done
+done
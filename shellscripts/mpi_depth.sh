@@ -0,0 +1,21 @@
+#!/bin/bash
+#SBATCH --job-name=Irene                     # Job name
+#SBATCH --output=output_mpi_depth_%j.txt     # Standard output and error log
+#SBATCH --nodes=8                            
+#SBATCH --ntasks-per-node=1                  # Number of MPI processes per node
+#SBATCH --time=01:50:00                      # Time limit hrs:min:sec
+
+# A mixed dataset (txt and random bin files, see src/file_generator.py): the bin blocks are only probed and stored,
+# the txt ones are compressed, so the workers go at different speeds
+DATASET_PATH="/home/i.dovichi/project/Distributed/data_mixed"
+
+# Blocks outstanding per worker (-p): 1 leaves the worker idle while its result goes back and the next block comes
+for i in 0 1 2 3 4; do
+    echo "Run,$i"
+    for d in 1 2 4 8; do
+        for p in 2 3 4 5 6 7 8; do
+            echo "Compression,$d,$p,$(mpirun -np $p --map-by ppr:1:node /home/i.dovichi/project/Distributed/mainmpi -p $d -C 1 $DATASET_PATH | grep 'Elapsed time' | awk '{print $3}')"
+            echo "Decompression,$d,$p,$(mpirun -np $p --map-by ppr:1:node /home/i.dovichi/project/Distributed/mainmpi -p $d -D 1 $DATASET_PATH | grep 'Elapsed time' | awk '{print $3}')"
+        done
+    done
+done
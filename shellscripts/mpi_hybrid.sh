@@ -0,0 +1,21 @@
+#!/bin/bash
+#SBATCH --job-name=Irene                     # Job name
+#SBATCH --output=output_mpi_hybrid_%j.txt    # Standard output and error log
+#SBATCH --nodes=8
+#SBATCH --ntasks-per-node=1                  # Number of MPI processes per node
+#SBATCH --time=01:50:00                      # Time limit hrs:min:sec
+
+
+DATASET_PATH="/home/i.dovichi/project/Distributed/data_strong"
+
+# Threads of each worker (-T, 0: all the cores of its node): one process per node, not bound to a core,
+# so that its threads can use the whole node
+for i in 0 1 2 3 4; do
+    echo "Run,$i"
+    for t in 1 2 4 8 0; do
+        for p in 2 3 4 5 6 7 8; do
+            echo "Compression,$t,$p,$(mpirun -np $p --map-by ppr:1:node --bind-to none /home/i.dovichi/project/Distributed/mainmpi -T $t -C 1 $DATASET_PATH | grep 'Elapsed time' | awk '{print $3}')"
+            echo "Decompression,$t,$p,$(mpirun -np $p --map-by ppr:1:node --bind-to none /home/i.dovichi/project/Distributed/mainmpi -T $t -D 1 $DATASET_PATH | grep 'Elapsed time' | awk '{print $3}')"
+        done
+    done
+done